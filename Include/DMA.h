@@ -6,6 +6,9 @@
 void DMA_Init(void);
 void Configure_DMA_For_Playback(uint16_t * source1, uint16_t * source2, uint32_t count, uint32_t num_playbacks);
 void Start_DMA_Playback(void);
+void Configure_DMA_For_Setpoint(uint32_t ch, uint32_t link_ch);
+void Start_DMA_Setpoint(uint32_t ch, uint32_t link_ch, uint16_t * codes, uint32_t * ldvals, uint32_t count);
+void Stop_DMA_Setpoint(uint32_t ch);
 
 #endif
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
@@ -41,10 +41,10 @@
 #define MMA_INT1_POS (14)
 #define MMA_INT2_POS (15)
 
-#define COUNTS_PER_G (16384.0)
+#define COUNTS_PER_G (16384)
 #define M_PI (3.14159265)
 
-#define MU 	(0.01)
+#define MU_INV 	(100) // MU = 1/MU_INV = 0.01
 #define SIGN(x) (x>=0? 1:-1)
 
 int init_mma(void);
@@ -54,9 +54,9 @@ void mma_set_active(uint8_t);
 void read_full_xyz(void);
 void read_xyz(void);
 void convert_xyz_to_roll_pitch(void);
-float Acc_Get_Magnitude(void);
+int Acc_Get_Magnitude(void); // mg
 
-extern float roll, pitch;
+extern int roll, pitch; // degrees
 extern int16_t acc_X, acc_Y, acc_Z;
 
 #endif
@@ -35,6 +35,12 @@
 // Set to 1 to enable setpoint validation (protects against TR_Setpoint_High fault)
 #define ENABLE_SETPOINT_VALIDATION  (0)
 
+// Set to 1 to enable the hardware overcurrent trip (overcurrent.h): between control
+// conversions the ADC compares the sense channel against OVERCURRENT_TRIP_mA, and
+// a result above it forces the PWM output off from the ADC interrupt.
+#define ENABLE_OVERCURRENT_TRIP  (0)
+#define OVERCURRENT_TRIP_mA  (300)
+
 // Set to 1 to enable flash period validation (protects against TR_Flash_Period fault)
 #define ENABLE_FLASH_PERIOD_VALIDATION  (0)
 
@@ -50,6 +56,14 @@
 // Restores MCG settings if corrupted
 #define ENABLE_MCG_SCRUB  (1)
 
+// Set to 1 to count saturation events in the inline fixed-point operations (FX.h)
+// in g_fx_overflow_count. Costs nothing unless an operation saturates.
+#define FX_COUNT_OVERFLOW  (1)
+
+// Set to 1 to time the controller kernels with SysTick at startup and show
+// the cycle counts on the LCD before the RTOS starts (see bench.c)
+#define ENABLE_KERNEL_BENCHMARK  (0)
+
 // LCD and Graphics Optimizations
 #define LCD_BUS_DEFAULTS_TO_DATA 1 
 #define DRAW_LINE_RUNS_AS_RECTANGLES 1 
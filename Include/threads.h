@@ -9,6 +9,7 @@
 #define THREAD_DRAW_WAVEFORM_PERIOD_TICKS (200) 
 #define THREAD_DRAW_UI_CONTROLS_PERIOD_TICKS (210) 
 #define THREAD_UPDATE_SETPOINT_PERIOD_TICKS (1)
+#define THREAD_SETPOINT_DMA_PERIOD_TICKS (16) // USE_DMA_SETPOINT: feeds the 32 ms COP
 #define THREAD_READ_ACCELEROMETER_PERIOD_TICKS (50) 
 
 #define PERIODIC_READ_ACCEL (1)
@@ -6,7 +6,12 @@
 
 #define LCD_UPDATE_PERIOD 10
 
+// TPM0 overflows left until the next control conversion (software divider,
+// TPM0_IRQHandler); the ADC server plans its conversions around it
+extern volatile uint32_t g_ctl_divider;
+
 void PIT_Init(int ch, unsigned period);
+void PIT_Init_Trigger(int ch, unsigned first, unsigned period);
 void PIT_Start(int ch);
 void PIT_Stop(int ch);
 
@@ -19,6 +24,8 @@ void Configure_TPM0_for_DMA(uint32_t period_us);
 void PWM_Init(TPM_Type * TPM, uint8_t channel_num, uint16_t period, uint16_t duty, 
 	uint8_t pos_polarity, uint8_t prescaler_code);
 void PWM_Set_Value(TPM_Type * TPM, uint8_t channel_num, uint16_t value);
+void TPM_Init_Trigger_Divider(TPM_Type * TPM, uint16_t period, uint8_t start_trigger);
+void TPM_Init_Trigger_Phase(TPM_Type * TPM, uint16_t period, uint16_t first, uint8_t start_trigger);
 
 
 void LPTMR_Init(void);
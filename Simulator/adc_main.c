@@ -0,0 +1,343 @@
+/*----------------------------------------------------------------------------
+ * ADC server harness
+ *
+ * Runs the low-priority conversion server from Source/ADC.c (ADC0_IRQHandler
+ * and the client calls) against a cycle model of TPM0, the ADC and one
+ * client thread, and reports request latency and conversion throughput for
+ * single, batched and overlapped requests. Time is in 48 MHz core cycles,
+ * which are also TPM0 counts and kernel timer counts.
+ *
+ * TPM0 counts up and down (PWM_PERIOD), overflows at the top, and every
+ * SW_CTL_FREQ_DIV_FACTOR overflows starts the control conversion as
+ * TPM0_IRQHandler does. A conversion takes the ADCK cycles of the profile
+ * in CFG1, CFG2 and SC3. A control conversion started while a low-priority
+ * one runs is counted as a collision. The control ISR and RTOS call costs
+ * are assumptions (-c, -r); set them from target measurements.
+ *----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <MKL25Z4.h>
+#include <cmsis_os2.h>
+#include "control.h"
+#include "timers.h"
+#include "ADC.h"
+#include "LCD_driver.h"
+
+#define NEVER (~0ull)
+#define IRQ_ENTRY_CYCLES (16)
+#define TPM_ISR_CYCLES (48)		// TPM0 overflow to the control conversion's SC1 write
+#define LOPRI_ISR_CYCLES (40)	// ADC ISR entry to reading a low-priority result
+#define TPM0_READ_CYCLES (2)
+#define SC1_IDLE (ADC_SC1_ADCH_MASK)	// ADCH 31: no conversion started
+#define DEF_CTL_ISR_CYCLES (800)	// ADC ISR entry to the end of CONTROL_HBLED
+#define DEF_RTOS_CYCLES (200)		// per kernel call, and per thread switch
+#define DEF_ROUNDS (1000)
+#define SET_SIZE (4)
+#define STALL_PERIODS (1000)
+#define STALL_CYCLES ((uint64_t) STALL_PERIODS*2*CTL_PERIOD)
+
+void ADC0_IRQHandler(void);
+
+static uint64_t now, next_tof, adc_end = NEVER;
+static int adc_sense, in_isr;
+static uint32_t ctl_isr_cycles = DEF_CTL_ISR_CYCLES, rtos_cycles = DEF_RTOS_CYCLES;
+static struct {
+	uint32_t Calls, Switches, Collisions;
+} os_stats;
+
+//=============================================================
+// Hardware
+//=============================================================
+// Up/down counter at the current time; reads take bus cycles, so two reads
+// in a row see it move, which is how ADC_Window_Left finds the direction
+TPM_Type * Sim_TPM0_Read(void) {
+	uint32_t phase;
+
+	now += TPM0_READ_CYCLES;
+	phase = (uint32_t)(now % (2*PWM_PERIOD)); // 0 at the overflow, the top
+	sim_TPM0.CNT = (phase < PWM_PERIOD)? PWM_PERIOD - phase : phase - PWM_PERIOD;
+	return &sim_TPM0;
+}
+
+// Conversion time of the configuration in CFG1, CFG2 and SC3 (ADC.h)
+static uint32_t ADC_Conv_Cycles(void) {
+	int mode = (sim_ADC0.CFG1 >> 2) & 3;
+	int lsts = (sim_ADC0.CFG1 & ADC_CFG1_ADLSMP_MASK)? (int)(sim_ADC0.CFG2 & 3) : -1;
+	int hsc = (sim_ADC0.CFG2 & ADC_CFG2_ADHSC_MASK) != 0;
+	int avg = (sim_ADC0.SC3 & ADC_SC3_AVGE_MASK)? (4 << (sim_ADC0.SC3 & 3)) : 1;
+
+	return 4*ADC_PROFILE_ADCK(mode, lsts, hsc, avg);
+}
+
+// Run the next TPM0 overflow or ADC completion and its ISR
+static void Sim_Event(void) {
+	uint64_t t = (next_tof < adc_end)? next_tof : adc_end;
+
+	if (now < t)
+		now = t;
+	in_isr = 1;
+	if (t == next_tof) { // TPM0_IRQHandler, software divider
+		next_tof += 2*PWM_PERIOD;
+		now += IRQ_ENTRY_CYCLES;
+		if (--g_ctl_divider == 0) {
+			g_ctl_divider = SW_CTL_FREQ_DIV_FACTOR;
+			now += TPM_ISR_CYCLES - IRQ_ENTRY_CYCLES;
+			if (adc_end != NEVER)
+				os_stats.Collisions++; // aborts the low-priority conversion
+			sim_ADC0.SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
+			adc_end = now + ADC_Conv_Cycles();
+			adc_sense = 1;
+		}
+	} else { // ADC0_IRQHandler
+		adc_end = NEVER;
+		*(volatile uint32_t *) &sim_ADC0.R[0] = adc_sense? 0 : 0x8000;
+		now += IRQ_ENTRY_CYCLES + (adc_sense? ctl_isr_cycles : LOPRI_ISR_CYCLES);
+		sim_ADC0.SC1[0] = SC1_IDLE;
+		ADC0_IRQHandler();
+		if (sim_ADC0.SC1[0] != SC1_IDLE) { // software-triggered low-priority conversion
+			adc_end = now + ADC_Conv_Cycles();
+			adc_sense = 0;
+		}
+	}
+	in_isr = 0;
+}
+
+// Client thread runs for `cycles`, preempted by the ISRs
+static void Sim_Thread_Run(uint32_t cycles) {
+	uint64_t t;
+
+	while (cycles > 0) {
+		t = (next_tof < adc_end)? next_tof : adc_end;
+		if (t >= now + cycles) {
+			now += cycles;
+			return;
+		}
+		if (t > now) {
+			cycles -= t - now;
+			now = t;
+		}
+		Sim_Event();
+	}
+}
+
+// Run ISRs while the client thread is blocked; a request that never
+// completes (no window ever fits it) ends the run instead of hanging it
+static void Sim_Blocked(uint64_t since) {
+	if (now - since > STALL_CYCLES) {
+		printf("Client blocked for %u control periods: no window fits its conversions\n", STALL_PERIODS);
+		exit(1);
+	}
+	Sim_Event();
+}
+
+static void OS_Call(void) {
+	os_stats.Calls++;
+	if (in_isr)
+		now += rtos_cycles;
+	else
+		Sim_Thread_Run(rtos_cycles);
+}
+
+// The client thread blocked until an ISR made progress possible
+static void OS_Wakeup(void) {
+	os_stats.Switches++;
+	Sim_Thread_Run(rtos_cycles);
+}
+
+//=============================================================
+// Kernel calls used by ADC.c
+//=============================================================
+typedef struct {
+	uint32_t Count, Size, Head, Used;
+	uint8_t * Buf;
+} SIM_QUEUE_T;
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t * attr) {
+	SIM_QUEUE_T * q = calloc(1, sizeof(SIM_QUEUE_T));
+
+	(void) attr;
+	q->Count = msg_count;
+	q->Size = msg_size;
+	q->Buf = calloc(msg_count, msg_size);
+	return q;
+}
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void * msg_ptr, uint8_t msg_prio, uint32_t timeout) {
+	SIM_QUEUE_T * q = mq_id;
+	uint64_t t;
+
+	(void) msg_prio;
+	OS_Call();
+	if (q->Used == q->Count) {
+		if (in_isr || (timeout == 0))
+			return osErrorResource;
+		for (t = now; q->Used == q->Count; )
+			Sim_Blocked(t);
+		OS_Wakeup();
+	}
+	memcpy(q->Buf + ((q->Head + q->Used) % q->Count)*q->Size, msg_ptr, q->Size);
+	q->Used++;
+	return osOK;
+}
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void * msg_ptr, uint8_t * msg_prio, uint32_t timeout) {
+	SIM_QUEUE_T * q = mq_id;
+	uint64_t t;
+
+	(void) msg_prio;
+	OS_Call();
+	if (q->Used == 0) {
+		if (in_isr || (timeout == 0))
+			return osErrorResource;
+		for (t = now; q->Used == 0; )
+			Sim_Blocked(t);
+		OS_Wakeup();
+	}
+	memcpy(msg_ptr, q->Buf + q->Head*q->Size, q->Size);
+	q->Head = (q->Head + 1) % q->Count;
+	q->Used--;
+	return osOK;
+}
+
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id) {
+	return ((SIM_QUEUE_T *) mq_id)->Used;
+}
+
+osThreadId_t osThreadGetId(void) {
+	return (osThreadId_t) &os_stats;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout) {
+	uint32_t set;
+	uint64_t t;
+
+	(void) options;
+	OS_Call();
+	if (!(sim_thread_flags & flags)) {
+		if (timeout == 0)
+			return osFlagsError;
+		for (t = now; !(sim_thread_flags & flags); )
+			Sim_Blocked(t);
+		OS_Wakeup();
+	}
+	set = sim_thread_flags & flags;
+	sim_thread_flags &= ~flags;
+	return set;
+}
+
+uint32_t osKernelGetSysTimerCount(void) {
+	return (uint32_t) now;
+}
+
+//=============================================================
+// Clients
+//=============================================================
+typedef enum {Single, Batch, Overlap, NUM_CLIENTS} CLIENT_E;
+static const char * Client_Names[NUM_CLIENTS] = {"single", "batch", "overlap"};
+
+// SET_SIZE channels read together: default profile, touchscreen profile
+static ADC_Conv_t Sets[2][SET_SIZE] = {
+	{{0, 0}, {3, 0}, {4, 0}, {5, 0}},
+	{{LCD_TS_YD_ADC_CHAN, LCD_TS_YD_ADC_MUXSEL}, {LCD_TS_XR_ADC_CHAN, LCD_TS_XR_ADC_MUXSEL},
+	 {LCD_TS_YD_ADC_CHAN, LCD_TS_YD_ADC_MUXSEL}, {LCD_TS_XR_ADC_CHAN, LCD_TS_XR_ADC_MUXSEL}},
+};
+static const char * Set_Names[2] = {"default", "touch"};
+
+static uint64_t lat_sum;
+static uint32_t lat_n;
+
+static void Note_Latency(void) {
+	lat_sum += g_adc_stats.Latency;
+	lat_n++;
+}
+
+// Read one set of SET_SIZE samples
+static void Client_Round(CLIENT_E c, ADC_Conv_t * conv) {
+	static ADC_Request_t req[SET_SIZE];
+	uint16_t sample[SET_SIZE];
+	int i;
+
+	switch (c) {
+		case Single: // request_conversion per channel, each waits for its sample
+			for (i = 0; i < SET_SIZE; i++) {
+				request_conversion(conv[i].Channel, conv[i].MuxSel);
+				Note_Latency();
+			}
+			break;
+		case Batch: // one request for all of them
+			request_conversions(conv, SET_SIZE, sample);
+			Note_Latency();
+			break;
+		case Overlap: // a request per channel, all submitted before waiting
+			for (i = 0; i < SET_SIZE; i++) {
+				req[i].Count = 1;
+				req[i].Conv[0] = conv[i];
+				req[i].Deadline = 0;
+				ADC_Submit(&req[i]);
+			}
+			for (i = 0; i < SET_SIZE; i++) {
+				ADC_Wait(&req[i], osWaitForever);
+				Note_Latency();
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+int main(int argc, char * argv[]) {
+	uint32_t rounds = DEF_ROUNDS, r, windows, max_round, ctl_cycles = 2*CTL_PERIOD;
+	uint64_t t0, t_round, sum_round;
+	int opt, s, c;
+
+	while ((opt = getopt(argc, argv, "n:c:r:h")) != -1) {
+		switch (opt) {
+			case 'n': rounds = strtoul(optarg, NULL, 0); break;
+			case 'c': ctl_isr_cycles = strtoul(optarg, NULL, 0); break;
+			case 'r': rtos_cycles = strtoul(optarg, NULL, 0); break;
+			default:
+				printf("Usage: %s [-n rounds] [-c control ISR cycles] [-r cycles per RTOS call]\n", argv[0]);
+				return (opt == 'h')? 0 : 1;
+		}
+	}
+
+	sim_ADC0.SC1[0] = ADC_SC1_COCO_MASK; // ADC_Calibrate finds the calibration done
+	Init_Buck_HBLED();
+	Init_ADC();
+	next_tof = 2*PWM_PERIOD;
+
+	printf("%-8s %-8s %10s %10s %10s %10s %10s %8s %8s %8s %6s\n", "profile", "client",
+		"round us", "max us", "ctl pers", "req us", "samples/ms", "windows", "calls/smp", "sw/smp", "coll");
+	for (s = 0; s < 2; s++) {
+		for (c = 0; c < NUM_CLIENTS; c++) {
+			memset((void *) &g_adc_stats, 0, sizeof(g_adc_stats));
+			memset(&os_stats, 0, sizeof(os_stats));
+			lat_sum = lat_n = 0;
+			sum_round = max_round = 0;
+			t0 = now;
+			for (r = 0; r < rounds; r++) {
+				t_round = now;
+				Client_Round(c, Sets[s]);
+				t_round = now - t_round;
+				sum_round += t_round;
+				if (t_round > max_round)
+					max_round = t_round;
+			}
+			windows = g_adc_stats.Windows;
+			printf("%-8s %-8s %10.1f %10.1f %10.2f %10.1f %10.1f %8.2f %8.2f %8.2f %6u\n", Set_Names[s], Client_Names[c],
+				sum_round/48.0/rounds, max_round/48.0, (double) sum_round/rounds/ctl_cycles,
+				lat_n? lat_sum/48.0/lat_n : 0.0, 48000.0*SET_SIZE*rounds/(now - t0),
+				(double) windows/rounds, (double) os_stats.Calls/(SET_SIZE*rounds),
+				(double) os_stats.Switches/(SET_SIZE*rounds), os_stats.Collisions);
+		}
+	}
+	printf("%u rounds of %d samples per line, back to back. Per round: time, and in control periods\n"
+		"(%u cycles); req: submit to wakeup per request (g_adc_stats.Latency). windows per round;\n"
+		"kernel calls and client thread switches per sample; coll: control conversions that found\n"
+		"the ADC busy. Assumed: control ISR %u cycles, %u cycles per kernel call and thread switch.\n",
+		rounds, SET_SIZE, ctl_cycles, ctl_isr_cycles, rtos_cycles);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*----------------------------------------------------------------------------
+ * Host controller kernel microbenchmarks
+ *
+ * Times the kernel table from Source/bench.c with the host monotonic clock
+ * and reports mean, min and worst-case nanoseconds per call. Host numbers
+ * are for relative comparison and regression tracking; target cycle counts
+ * come from the same table via Bench_Run_On_Target (ENABLE_KERNEL_BENCHMARK).
+ *----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <MKL25Z4.h>
+#include "control.h"
+#include "bench.h"
+
+#define DEF_ITERATIONS (1000000)
+
+static uint32_t Host_Now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec*1000000000ull + ts.tv_nsec);
+}
+
+int main(int argc, char * argv[]) {
+	BENCH_RESULT_T results[BENCH_MAX_KERNELS];
+	uint32_t iterations = DEF_ITERATIONS;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "i:h")) != -1) {
+		switch (opt) {
+			case 'i': iterations = strtoul(optarg, NULL, 0); break;
+			default:
+				printf("Usage: %s [-i iterations]\n", argv[0]);
+				return (opt == 'h')? 0 : 1;
+		}
+	}
+
+	Init_Buck_HBLED();
+	*(volatile uint32_t *) &ADC0->R[0] = MA_To_ADC_Code(FLASH_CURRENT_MA); // near the setpoint
+	n = Bench_Run(Host_Now_ns, 0xFFFFFFFF, iterations, results);
+
+	printf("%-14s %10s %10s %10s\n", "kernel", "mean ns", "min ns", "max ns");
+	for (int k = 0; k < n; k++)
+		printf("%-14s %10u %10u %10u\n", results[k].Name, results[k].Mean, results[k].Min, results[k].Max);
+	printf("%d iterations per kernel, timer overhead removed; host max includes OS preemption\n", iterations);
+	printf("Target budget: %d core cycles per control update (PWM_PERIOD %d, CTL_FREQ_DIV_FACTOR %d)\n",
+		BENCH_CTL_BUDGET_CYCLES, PWM_PERIOD, CTL_FREQ_DIV_FACTOR);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <math.h>
+#include "plant.h"
+
+void Plant_Default_Params(PLANT_PARAM_T * p) {
+	p->VIn = PLANT_DEF_V_IN;
+	p->L = PLANT_DEF_L;
+	p->RL = PLANT_DEF_R_L;
+	p->VLED = PLANT_DEF_V_LED;
+	p->RLED = PLANT_DEF_R_LED;
+	p->VDiode = PLANT_DEF_V_DIODE;
+	p->RSense = PLANT_DEF_R_SENSE;
+}
+
+void Plant_Init(PLANT_T * plant, const PLANT_PARAM_T * p) {
+	plant->P = *p;
+	plant->Tau = p->L/(p->RL + p->RLED + p->RSense);
+	plant->I = 0;
+	Plant_Clear_Stats(plant);
+}
+
+void Plant_Clear_Stats(PLANT_T * plant) {
+	plant->IMax = plant->I;
+	plant->IMin = plant->I;
+	plant->Charge = 0;
+	plant->Time = 0;
+}
+
+void Plant_Advance(PLANT_T * plant, int switch_on, double dt) {
+	double v_sw, r, i_inf, i0, i1, e, t_zero;
+
+	if (dt <= 0)
+		return;
+	plant->Time += dt;
+
+	r = plant->P.RL + plant->P.RLED + plant->P.RSense;
+	v_sw = switch_on? plant->P.VIn : -plant->P.VDiode;
+	i_inf = (v_sw - plant->P.VLED)/r; // current the state decays toward
+	i0 = plant->I;
+
+	if ((i0 <= 0) && (i_inf <= 0)) {
+		// LED blocks: no conduction for this whole interval
+		plant->I = 0;
+		if (plant->IMin > 0)
+			plant->IMin = 0;
+		return;
+	}
+
+	e = exp(-dt/plant->Tau);
+	i1 = i_inf + (i0 - i_inf)*e;
+	if (i1 < 0) {
+		// Current reaches zero inside the interval, then stays there (DCM)
+		t_zero = plant->Tau*log((i0 - i_inf)/(-i_inf));
+		plant->Charge += i_inf*t_zero + (i0 - i_inf)*plant->Tau*(1 - exp(-t_zero/plant->Tau));
+		i1 = 0;
+	} else {
+		plant->Charge += i_inf*dt + (i0 - i_inf)*plant->Tau*(1 - e);
+	}
+	plant->I = i1;
+	// Monotonic within an interval, so extremes are at the end points
+	if (i1 > plant->IMax)
+		plant->IMax = i1;
+	if (i1 < plant->IMin)
+		plant->IMin = i1;
+}
@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------
+ * Buck converter + HBLED + R_SENSE plant model (host simulator)
+ *
+ * Single-state model: inductor current I equals LED current equals sense
+ * resistor current. With the switch on the inductor sees V_in, with it off
+ * the freewheel diode clamps the switch node to -V_diode. The LED is a knee
+ * voltage plus dynamic resistance and blocks reverse current, so the
+ * converter drops into discontinuous conduction when I reaches zero.
+ *
+ * Each switch state is a first-order linear ODE, so Plant_Advance() uses
+ * the exact exponential solution rather than fixed-step integration. That
+ * keeps the model accurate at any step length, so a whole PWM phase costs
+ * one exp().
+ *----------------------------------------------------------------------------*/
+#ifndef PLANT_H
+#define PLANT_H
+
+// Default component values. Replace with characterized values per board.
+#define PLANT_DEF_V_IN			(5.0)			// V, USB supply
+#define PLANT_DEF_L					(1.0e-3)	// H
+#define PLANT_DEF_R_L				(0.5)			// Ohm, inductor DCR + switch on resistance
+#define PLANT_DEF_V_LED			(2.70)		// V, LED knee voltage
+#define PLANT_DEF_R_LED			(3.0)			// Ohm, LED dynamic resistance
+#define PLANT_DEF_V_DIODE		(0.35)		// V, Schottky freewheel diode
+#define PLANT_DEF_R_SENSE		(2.2)			// Ohm, matches R_SENSE in control.h
+
+typedef struct {
+	double VIn, L, RL, VLED, RLED, VDiode, RSense;
+} PLANT_PARAM_T;
+
+typedef struct {
+	PLANT_PARAM_T P;
+	double Tau;						// L/R_total, s
+	double I;							// inductor current, A
+	// Accumulators, cleared by Plant_Clear_Stats
+	double IMax, IMin;		// extremes of instantaneous current, A
+	double Charge;				// integral of I dt, A*s
+	double Time;					// s
+} PLANT_T;
+
+void Plant_Default_Params(PLANT_PARAM_T * p);
+void Plant_Init(PLANT_T * plant, const PLANT_PARAM_T * p);
+void Plant_Clear_Stats(PLANT_T * plant);
+void Plant_Advance(PLANT_T * plant, int switch_on, double dt);
+
+#endif // PLANT_H
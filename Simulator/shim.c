@@ -0,0 +1,88 @@
+/*----------------------------------------------------------------------------
+ * Host shim definitions: peripheral register storage and the few firmware
+ * symbols that live in modules the simulator does not compile (main.c,
+ * debug.c, timers.c, ADC.c).
+ *----------------------------------------------------------------------------*/
+#include <MKL25Z4.h>
+#include "debug.h"
+#include "control.h"
+#include "timers.h"
+
+ADC_Type sim_ADC0;
+TPM_Type sim_TPM0, sim_TPM1, sim_TPM2;
+DAC_Type sim_DAC0;
+SIM_Type sim_SIM;
+DMA_Type sim_DMA0;
+PIT_Type sim_PIT;
+MCG_Type sim_MCG;
+PORT_Type sim_PORTB, sim_PORTD, sim_PORTE;
+FGPIO_Type sim_FPTB, sim_FPTD, sim_FPTE;
+
+// From main.c
+volatile CTL_MODE_E control_mode = DEF_CONTROL_MODE;
+
+// From debug.c. Debug signals just write into the shim FGPIO registers.
+debug_GPIO_struct debug_GPIO[DBG_NUM_SIGNALS] = {
+	{0, 0, FPTD, PORTD},
+	{0, 2, FPTD, PORTD},
+	{0, 3, FPTD, PORTD},
+	{0, 4, FPTD, PORTD},
+	{0, 8, FPTB, PORTB},
+	{0, 9, FPTB, PORTB},
+	{0, 10, FPTB, PORTB},
+	{0, 11, FPTB, PORTB},
+#if DBG_USE_SPI_SIGNALS
+	{0, 2, FPTE, PORTE},
+	{0, 3, FPTE, PORTE},
+	{0, 1, FPTE, PORTE},
+	{0, 4, FPTE, PORTE},
+#endif
+	{0, 31, FPTB, PORTB }, // NULL
+};
+
+// Thread flags for the osThreadFlagsSet shim (cmsis_os2.h)
+volatile uint32_t sim_thread_flags;
+
+// From ADC.c. The simulated ADC has no offset or gain error to calibrate.
+// Weak: the ADC server harness links the real one.
+__attribute__((weak)) int ADC_Calibrate(void) {
+	return 1;
+}
+
+// From timers.c. Harnesses that run TPM0_IRQHandler's divider count it down here.
+volatile uint32_t g_ctl_divider = SW_CTL_FREQ_DIV_FACTOR;
+
+// From timers.c. Same register effects, minus clock gating and NVIC setup.
+void PWM_Init(TPM_Type * TPM, uint8_t channel_num, uint16_t period, uint16_t duty,
+	uint8_t pos_polarity, uint8_t prescaler_code)
+{
+	TPM->MOD = period;
+	if (pos_polarity) {
+		TPM->CONTROLS[channel_num].CnSC = TPM_CnSC_MSB_MASK | TPM_CnSC_ELSB_MASK;
+	} else {
+		TPM->CONTROLS[channel_num].CnSC = TPM_CnSC_MSB_MASK | TPM_CnSC_ELSA_MASK;
+	}
+	TPM->SC = (TPM_SC_CPWMS_MASK | TPM_SC_PS(prescaler_code));
+	TPM->CONTROLS[channel_num].CnV = duty;
+#if USE_TPM0_INTERRUPT
+	TPM0->SC |= TPM_SC_TOIE_MASK;
+#endif
+	TPM->SC |= TPM_SC_CMOD(1);
+}
+
+void TPM_Init_Trigger_Divider(TPM_Type * TPM, uint16_t period, uint8_t start_trigger) {
+	TPM_Init_Trigger_Phase(TPM, period, period, start_trigger);
+}
+
+void TPM_Init_Trigger_Phase(TPM_Type * TPM, uint16_t period, uint16_t first, uint8_t start_trigger) {
+	TPM->SC = 0;
+	TPM->CNT = 0;
+	TPM->MOD = first - 1;
+	TPM->CONF = TPM_CONF_CSOT_MASK | TPM_CONF_TRGSEL(start_trigger);
+	TPM->SC = TPM_SC_PS(0) | TPM_SC_CMOD(1);
+	TPM->MOD = period - 1;
+}
+
+void PWM_Set_Value(TPM_Type * TPM, uint8_t channel_num, uint16_t value) {
+	TPM->CONTROLS[channel_num].CnV = value;
+}
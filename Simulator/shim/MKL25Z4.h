@@ -0,0 +1,287 @@
+/*----------------------------------------------------------------------------
+ * Host register shim for MKL25Z4
+ *
+ * Stands in for the device header when Source/control.c and friends are
+ * compiled on the host by the plant simulator. Only the peripherals the
+ * control path touches (ADC0, TPM0, DAC0, SIM, PORTE, FGPIO) are modeled.
+ * DMA0, PIT and MCG are declared for the sources that float-check compiles
+ * but the simulator does not link (timers.c, setpoint_dma.c, threads.c).
+ * Register and field names match the real device header so the firmware
+ * sources compile unmodified. Peripherals are plain memory; the simulator
+ * (sim_main.c) plays the role of the hardware by reading and writing them.
+ *----------------------------------------------------------------------------*/
+#ifndef MKL25Z4_SHIM_H
+#define MKL25Z4_SHIM_H
+
+#include <stdint.h>
+
+#define __I  volatile const
+#define __O  volatile
+#define __IO volatile
+
+#ifndef __ALIGNED
+#define __ALIGNED(x) __attribute__((aligned(x)))
+#endif
+#ifndef __STATIC_FORCEINLINE
+#define __STATIC_FORCEINLINE __attribute__((always_inline)) static inline
+#endif
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+
+typedef enum {
+	DMA0_IRQn = 0, ADC0_IRQn = 15, TPM0_IRQn = 17, PIT_IRQn = 22, PORTA_IRQn = 30
+} IRQn_Type;
+
+// ADC
+typedef struct {
+	__IO uint32_t SC1[2];
+	__IO uint32_t CFG1;
+	__IO uint32_t CFG2;
+	__I  uint32_t R[2];
+	__IO uint32_t CV1;
+	__IO uint32_t CV2;
+	__IO uint32_t SC2;
+	__IO uint32_t SC3;
+	__IO uint32_t OFS;
+	__IO uint32_t PG;
+	__IO uint32_t MG;
+	__IO uint32_t CLPD, CLPS, CLP4, CLP3, CLP2, CLP1, CLP0;
+	uint32_t RESERVED_0[1];
+	__IO uint32_t CLMD, CLMS, CLM4, CLM3, CLM2, CLM1, CLM0;
+} ADC_Type;
+
+// TPM
+typedef struct {
+	__IO uint32_t SC;
+	__IO uint32_t CNT;
+	__IO uint32_t MOD;
+	struct {
+		__IO uint32_t CnSC;
+		__IO uint32_t CnV;
+	} CONTROLS[6];
+	uint32_t RESERVED_0[5];
+	__IO uint32_t STATUS;
+	uint32_t RESERVED_1[12];
+	__IO uint32_t CONF;
+} TPM_Type;
+
+// DAC
+typedef struct {
+	struct {
+		__IO uint8_t DATL;
+		__IO uint8_t DATH;
+	} DAT[2];
+	uint8_t RESERVED_0[28];
+	__IO uint8_t SR;
+	__IO uint8_t C0;
+	__IO uint8_t C1;
+	__IO uint8_t C2;
+} DAC_Type;
+
+// SIM (subset)
+typedef struct {
+	__IO uint32_t SOPT1, SOPT2, SOPT4, SOPT5, SOPT7;
+	__IO uint32_t SCGC4, SCGC5, SCGC6, SCGC7;
+	__IO uint32_t CLKDIV1;
+	__IO uint32_t COPC;
+	__O  uint32_t SRVCOP;
+} SIM_Type;
+
+// DMA (subset)
+typedef struct {
+	struct {
+		__IO uint32_t SAR;
+		__IO uint32_t DAR;
+		__IO uint32_t DSR_BCR;
+		__IO uint32_t DCR;
+	} DMA[4];
+} DMA_Type;
+
+// PIT
+typedef struct {
+	__IO uint32_t MCR;
+	uint32_t RESERVED_0[55];
+	__I  uint32_t LTMR64H;
+	__I  uint32_t LTMR64L;
+	uint32_t RESERVED_1[6];
+	struct {
+		__IO uint32_t LDVAL;
+		__I  uint32_t CVAL;
+		__IO uint32_t TCTRL;
+		__IO uint32_t TFLG;
+	} CHANNEL[2];
+} PIT_Type;
+
+// MCG (subset)
+typedef struct {
+	__IO uint8_t C1, C2, C3, C4, C5, C6;
+	__IO uint8_t S;
+} MCG_Type;
+
+// PORT
+typedef struct {
+	__IO uint32_t PCR[32];
+} PORT_Type, *PORT_MemMapPtr;
+
+// FGPIO
+typedef struct {
+	__IO uint32_t PDOR;
+	__O  uint32_t PSOR;
+	__O  uint32_t PCOR;
+	__O  uint32_t PTOR;
+	__I  uint32_t PDIR;
+	__IO uint32_t PDDR;
+} FGPIO_Type, *FGPIO_MemMapPtr;
+
+// Peripheral instances, defined in shim.c
+extern ADC_Type sim_ADC0;
+extern TPM_Type sim_TPM0, sim_TPM1, sim_TPM2;
+extern DAC_Type sim_DAC0;
+extern SIM_Type sim_SIM;
+extern DMA_Type sim_DMA0;
+extern PIT_Type sim_PIT;
+extern MCG_Type sim_MCG;
+extern PORT_Type sim_PORTB, sim_PORTD, sim_PORTE;
+extern FGPIO_Type sim_FPTB, sim_FPTD, sim_FPTE;
+
+#ifndef SHIM_DEVICE_ADDRESSES
+#define ADC0	(&sim_ADC0)
+#ifdef SHIM_TPM0_READ
+// A harness whose TPM0 counter runs between reads (adc_main.c)
+TPM_Type * SHIM_TPM0_READ(void);
+#define TPM0	(SHIM_TPM0_READ())
+#else
+#define TPM0	(&sim_TPM0)
+#endif
+#define TPM1	(&sim_TPM1)
+#define TPM2	(&sim_TPM2)
+#define DAC0	(&sim_DAC0)
+#define SIM		(&sim_SIM)
+#define DMA0	(&sim_DMA0)
+#define PIT		(&sim_PIT)
+#define MCG		(&sim_MCG)
+#define PORTB	(&sim_PORTB)
+#define PORTD	(&sim_PORTD)
+#define PORTE	(&sim_PORTE)
+#define FPTB	(&sim_FPTB)
+#define FPTD	(&sim_FPTD)
+#define FPTE	(&sim_FPTE)
+#else
+// Compile-only (float-check): the device addresses, so code that switches
+// on a peripheral pointer (PWM_Init) compiles as it does for the target
+#define ADC0	((ADC_Type *) 0x4003B000u)
+#define TPM0	((TPM_Type *) 0x40038000u)
+#define TPM1	((TPM_Type *) 0x40039000u)
+#define TPM2	((TPM_Type *) 0x4003A000u)
+#define DAC0	((DAC_Type *) 0x4003F000u)
+#define SIM		((SIM_Type *) 0x40047000u)
+#define DMA0	((DMA_Type *) 0x40008100u)
+#define PIT		((PIT_Type *) 0x40037000u)
+#define MCG		((MCG_Type *) 0x40064000u)
+#define PORTB	((PORT_Type *) 0x4004A000u)
+#define PORTD	((PORT_Type *) 0x4004C000u)
+#define PORTE	((PORT_Type *) 0x4004D000u)
+#define FPTB	((FGPIO_Type *) 0xF80FF040u)
+#define FPTD	((FGPIO_Type *) 0xF80FF0C0u)
+#define FPTE	((FGPIO_Type *) 0xF80FF100u)
+#endif
+
+// ADC fields
+#define ADC_SC1_ADCH_MASK			0x1Fu
+#define ADC_SC1_ADCH(x)				(((uint32_t)(x))&ADC_SC1_ADCH_MASK)
+#define ADC_SC1_AIEN_MASK			0x40u
+#define ADC_SC1_AIEN(x)				((((uint32_t)(x))<<6)&ADC_SC1_AIEN_MASK)
+#define ADC_SC1_COCO_MASK			0x80u
+#define ADC_CFG1_ADICLK(x)		(((uint32_t)(x))&0x3u)
+#define ADC_CFG1_MODE(x)			((((uint32_t)(x))<<2)&0xCu)
+#define ADC_CFG1_ADLSMP_MASK	0x10u
+#define ADC_CFG1_ADIV(x)			((((uint32_t)(x))<<5)&0x60u)
+#define ADC_CFG1_ADLPC_MASK		0x80u
+#define ADC_CFG2_ADLSTS(x)		(((uint32_t)(x))&0x3u)
+#define ADC_CFG2_ADHSC_MASK		0x4u
+#define ADC_CFG2_MUXSEL_MASK	0x10u
+#define ADC_SC2_REFSEL(x)			(((uint32_t)(x))&0x3u)
+#define ADC_SC2_DMAEN_MASK		0x4u
+#define ADC_SC2_ACREN_MASK		0x8u
+#define ADC_SC2_ACFGT_MASK		0x10u
+#define ADC_SC2_ACFE_MASK			0x20u
+#define ADC_SC2_ADTRG_MASK		0x40u
+#define ADC_SC2_ADTRG(x)			((((uint32_t)(x))<<6)&ADC_SC2_ADTRG_MASK)
+#define ADC_SC2_ADACT_MASK		0x80u
+#define ADC_SC3_AVGS(x)				(((uint32_t)(x))&0x3u)
+#define ADC_SC3_AVGE_MASK			0x4u
+#define ADC_SC3_ADCO_MASK			0x8u
+#define ADC_SC3_CALF_MASK			0x40u
+#define ADC_SC3_CAL_MASK			0x80u
+
+// TPM fields
+#define TPM_SC_PS(x)					(((uint32_t)(x))&0x7u)
+#define TPM_SC_CMOD(x)				((((uint32_t)(x))<<3)&0x18u)
+#define TPM_SC_CPWMS_MASK			0x20u
+#define TPM_SC_TOIE_MASK			0x40u
+#define TPM_SC_TOF_MASK				0x80u
+#define TPM_SC_DMA_MASK				0x100u
+#define TPM_MOD_MOD(x)				(((uint32_t)(x))&0xFFFFu)
+#define TPM_CnSC_DMA_MASK			0x1u
+#define TPM_CnSC_ELSA_MASK		0x4u
+#define TPM_CnSC_ELSB_MASK		0x8u
+#define TPM_CnSC_MSA_MASK			0x10u
+#define TPM_CnSC_MSB_MASK			0x20u
+#define TPM_CnSC_CHIE_MASK		0x40u
+#define TPM_CnSC_CHF_MASK			0x80u
+#define TPM_CONF_DBGMODE(x)		((((uint32_t)(x))<<6)&0xC0u)
+#define TPM_CONF_CSOT_MASK		0x10000u
+#define TPM_CONF_TRGSEL(x)		((((uint32_t)(x))<<24)&0x0F000000u)
+
+// DAC fields
+#define DAC_C0_DACRFS_MASK		0x40u
+#define DAC_C0_DACEN_MASK			0x80u
+
+// SIM fields
+#define SIM_SOPT2_PLLFLLSEL_MASK		0x10000u
+#define SIM_SOPT2_TPMSRC(x)					((((uint32_t)(x))<<24)&0x3000000u)
+#define SIM_SOPT7_ADC0TRGSEL(x)			(((uint32_t)(x))&0xFu)
+#define SIM_SOPT7_ADC0ALTTRGEN_MASK	0x80u
+#define SIM_SCGC5_PORTB_MASK				0x400u
+#define SIM_SCGC5_PORTD_MASK				0x1000u
+#define SIM_SCGC5_PORTE_MASK				0x2000u
+#define SIM_SCGC6_DMAMUX_MASK				0x2u
+#define SIM_SCGC6_PIT_MASK					0x800000u
+#define SIM_SCGC6_TPM0_MASK					0x1000000u
+#define SIM_SCGC6_TPM1_MASK					0x2000000u
+#define SIM_SCGC6_TPM2_MASK					0x4000000u
+#define SIM_SCGC6_ADC0_MASK					0x8000000u
+#define SIM_SCGC6_DAC0_MASK					0x80000000u
+
+// DMA fields
+#define DMA_DSR_BCR_BCR_MASK	0xFFFFFFu
+#define DMA_DSR_BCR_BCR(x)		(((uint32_t)(x))&DMA_DSR_BCR_BCR_MASK)
+#define DMA_DSR_BCR_DONE_MASK	0x1000000u
+
+// PIT fields
+#define PIT_MCR_FRZ_MASK			0x1u
+#define PIT_MCR_MDIS_MASK			0x2u
+#define PIT_LDVAL_TSV(x)			((uint32_t)(x))
+#define PIT_TCTRL_TEN_MASK		0x1u
+#define PIT_TCTRL_TIE_MASK		0x2u
+#define PIT_TCTRL_CHN_MASK		0x4u
+#define PIT_TFLG_TIF_MASK			0x1u
+
+// MCG fields
+#define MCG_C5_PRDIV0(x)			(((uint8_t)(x))&0x1Fu)
+
+// PORT fields
+#define PORT_PCR_PE_MASK			0x2u
+#define PORT_PCR_MUX_MASK			0x700u
+#define PORT_PCR_MUX(x)				((((uint32_t)(x))<<8)&PORT_PCR_MUX_MASK)
+
+// Core functions: interrupts are dispatched by the simulator, so these are no-ops
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type irq, uint32_t pri) { (void) irq; (void) pri; }
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type irq) { (void) irq; }
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type irq) { (void) irq; }
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type irq) { (void) irq; }
+__STATIC_INLINE void __disable_irq(void) { }
+__STATIC_INLINE void __enable_irq(void) { }
+
+#endif // MKL25Z4_SHIM_H
@@ -0,0 +1,92 @@
+/*----------------------------------------------------------------------------
+ * Host shim for CMSIS-RTOS2
+ *
+ * Provides just the types and calls the control path headers reference.
+ * The simulator is single-threaded: it calls Update_Set_Current() and the
+ * ISR bodies directly in simulated time, so no kernel is needed.
+ * The kernel calls below are declared, not defined, for the sources that
+ * float-check compiles but the simulator does not link (ADC.c, threads.c).
+ * The ADC server harness (adc_main.c) defines the ones ADC.c uses.
+ *----------------------------------------------------------------------------*/
+#ifndef CMSIS_OS2_SHIM_H
+#define CMSIS_OS2_SHIM_H
+
+#include <stdint.h>
+
+typedef enum {
+	osOK = 0, osError = -1, osErrorTimeout = -2, osErrorResource = -3, osErrorParameter = -4
+} osStatus_t;
+
+typedef void * osThreadId_t;
+typedef void * osMutexId_t;
+typedef void * osEventFlagsId_t;
+typedef void * osMessageQueueId_t;
+
+typedef enum {
+	osPriorityNone = 0, osPriorityIdle = 1, osPriorityLow = 8, osPriorityBelowNormal = 16,
+	osPriorityNormal = 24, osPriorityAboveNormal = 32, osPriorityHigh = 40, osPriorityRealtime = 48
+} osPriority_t;
+
+typedef void (*osThreadFunc_t)(void * argument);
+
+typedef struct {
+	const char * name;
+	uint32_t attr_bits;
+	void * cb_mem;
+	uint32_t cb_size;
+} osMutexAttr_t, osEventFlagsAttr_t;
+
+typedef struct {
+	const char * name;
+	uint32_t attr_bits;
+	void * cb_mem;
+	uint32_t cb_size;
+	void * stack_mem;
+	uint32_t stack_size;
+	osPriority_t priority;
+	uint32_t tz_module;
+	uint32_t reserved;
+} osThreadAttr_t;
+
+typedef struct {
+	const char * name;
+	uint32_t attr_bits;
+	void * cb_mem;
+	uint32_t cb_size;
+	void * mq_mem;
+	uint32_t mq_size;
+} osMessageQueueAttr_t;
+
+#define osWaitForever 0xFFFFFFFFu
+#define osFlagsWaitAny 0x00000000u
+#define osFlagsError 0x80000000u
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void * argument, const osThreadAttr_t * attr);
+osThreadId_t osThreadGetId(void);
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout);
+uint32_t osKernelGetTickCount(void);
+uint32_t osKernelGetSysTimerCount(void);
+osStatus_t osDelayUntil(uint32_t ticks);
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout);
+osStatus_t osMutexRelease(osMutexId_t mutex_id);
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t * attr);
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout);
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t * attr);
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void * msg_ptr, uint8_t msg_prio, uint32_t timeout);
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void * msg_ptr, uint8_t * msg_prio, uint32_t timeout);
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id);
+
+static inline uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags) {
+	(void) ef_id;
+	return flags;
+}
+
+// One thread's flags, defined in shim.c
+extern volatile uint32_t sim_thread_flags;
+
+static inline uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags) {
+	(void) thread_id;
+	return sim_thread_flags |= flags;
+}
+
+#endif // CMSIS_OS2_SHIM_H
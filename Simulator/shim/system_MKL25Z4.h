@@ -0,0 +1,14 @@
+/*----------------------------------------------------------------------------
+ * Host shim for the MKL25Z4 system header
+ *
+ * SystemCoreClock for the headers that derive timer periods from it
+ * (Profiler/profile.h, LCD_driver.h). 48 MHz, as on the board.
+ *----------------------------------------------------------------------------*/
+#ifndef SYSTEM_MKL25Z4_SHIM_H
+#define SYSTEM_MKL25Z4_SHIM_H
+
+#include <stdint.h>
+
+#define SystemCoreClock (48000000u)
+
+#endif // SYSTEM_MKL25Z4_SHIM_H
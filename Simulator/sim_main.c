@@ -0,0 +1,1043 @@
+/*----------------------------------------------------------------------------
+ * Closed-loop HBLED plant simulator
+ *
+ * Runs Source/control.c (Control_HBLED, Update_Set_Current) unmodified on
+ * the host against the register shim and the buck/LED model in plant.c.
+ * The simulator plays the hardware and the RTOS:
+ *   - TPM0 overflow every PWM period: CnV is latched and a conversion
+ *     starts every CTL_FREQ_DIV_FACTOR periods, either by the
+ *     TPM0_IRQHandler software divider (USE_SYNC_SW_CTL_FREQ_DIV) or by
+ *     the trigger timer (USE_SYNC_HW_CTL_FREQ_DIV). With
+ *     USE_ADAPTIVE_CTL_RATE the divider is Control_Rate_Tick.
+ *   - The conversion samples the plant ADC_SAMPLE_DELAY counts after the
+ *     overflow; ADC0->R[0] is loaded and the ADC ISR (Control_HBLED) runs.
+ *     With USE_ADC_SAMPLE_PHASE the trigger comes g_adc_sample_phase counts
+ *     after the overflow that starts the control period, in whichever PWM
+ *     period that falls, and the sample ADC_SAMPLE_DELAY counts later.
+ *     With ADC_HW_AVG_SAMPLES > 1 the result is the mean of that many
+ *     samples, ADC_AVG_SPACING counts apart; samples past the end of the
+ *     PWM period are not modeled. With USE_ADC_OVERSAMPLING every period
+ *     converts and the results go through ADC_Decim_Add (adc_decim.h).
+ *   - ENABLE_OVERCURRENT_TRIP: while the compare conversions are armed, a
+ *     PWM period whose peak current reaches OVERCURRENT_TRIP_CODE trips at
+ *     its end (the hardware trips within a conversion time), and the output
+ *     stays off while PTE31 is not muxed to TPM0.
+ *   - Every 1 ms of simulated time Thread_Update_Setpoint's body
+ *     (Update_Set_Current) runs. USE_DMA_SETPOINT is not modeled; its
+ *     playback is the same setpoint sequence on the same 1 ms grid.
+ *   - Thread_Draw_Waveforms is emulated by releasing a Full scope buffer,
+ *     after handing it to the autotuner (USE_AUTOTUNE) and the rise-time
+ *     measurement (USE_SETPOINT_SHAPING).
+ *
+ * For every flash pulse it reports rise time (10-90%), settling time into a
+ * +/- band, overshoot, steady-state error, current ripple (mean
+ * per-PWM-period peak-to-peak over the second half of the pulse) and swing
+ * (peak-to-peak of the per-period mean current over the second half: a
+ * limit cycle of the loop, where ripple is the inductor's).
+ * Settling is judged on the mean current of each PWM period, which averages
+ * out the inductor ripple, against the final value: the setpoint plus the
+ * steady-state error. The controllers regulate the sampled current, which
+ * sits a few mA off the mean, so a band around the setpoint alone can be
+ * narrower than that offset. A pulse that never reaches 90 % has not settled.
+ *----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <MKL25Z4.h>
+#include "control.h"
+#include "timers.h"
+#include "plant.h"
+#include "gain_sched.h"
+#include "ilc.h"
+#include "deadbeat.h"
+#include "predictor.h"
+#include "waveform.h"
+#if USE_DUTY_FEEDFORWARD
+#include "feedforward.h"
+#endif
+#if USE_AUTOTUNE
+#include "autotune.h"
+#endif
+#if USE_SETPOINT_SHAPING
+#include "setpoint_shape.h"
+#endif
+#if USE_DITHERED_PWM
+#include "pwm_dither.h"
+#endif
+#if USE_ADC_OVERSAMPLING
+#include "adc_decim.h"
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+#include "overcurrent.h"
+#endif
+
+#if USE_DMA_SETPOINT
+#error "The simulator has no DMA or PIT model: build it with USE_DMA_SETPOINT 0"
+#endif
+
+#define TPM_CLOCK_HZ				(48000000)
+#define TICK_COUNTS					(TPM_CLOCK_HZ/1000) // RTOS tick, 1 ms
+#define ADC_SAMPLE_DELAY		(48) // TPM counts from overflow to ADC sample phase (~1 us)
+#define ADC_AVG_SPACING			((ADC_CONV_ADCK(2) - ADC_CONV_ADCK(1))*(TPM_CLOCK_HZ/12000000)) // one averaged conversion
+#define DEF_SETTLE_BAND_PCT	(5)
+#define PULSE_MAX_PERIODS		(8192)	// settling is judged over this much of a pulse
+#define DEF_NUM_FLASHES			(5)
+
+typedef struct {
+	int Active;
+	int Count;
+	double SetmA;
+	double TStart, TFirst10, TFirst90, TMid;
+	double MaxAvgmA;
+	float Err[PULSE_MAX_PERIODS];	// mean current minus setpoint, per PWM period
+	double TEnd[PULSE_MAX_PERIODS];
+	int N;
+	double RippleSum, ErrSum;
+	double SwingMin, SwingMax;		// per-period mean minus setpoint, second half
+	int RippleN;
+} PULSE_T;
+
+typedef struct {
+	int Pulses, Settled;
+	double RiseSum, SettleSum, WorstOvershoot, RippleSum, ErrSum, SwingSum;
+	long Steps, Periods;
+	double WallSec;
+	double NoiseSq;				// sum of squared sense errors, LSB^2
+	long NoiseN;
+	int Trips;						// overcurrent trips (ENABLE_OVERCURRENT_TRIP)
+} SUMMARY_T;
+
+static const char * Mode_Names[MODE_COUNT] = {
+	[OpenLoop] = "OpenLoop",
+	[BangBang] = "BangBang",
+	[Incremental] = "Incremental",
+	[Proportional] = "Proportional",
+	[PID] = "PID",
+	[PID_FX] = "PID_FX",
+	[PID_FX_GS] = "PID_FX_GS",
+	[ILC] = "ILC",
+	[Deadbeat] = "Deadbeat",
+	[Autotune] = "Autotune",
+};
+
+static PLANT_PARAM_T plant_params;
+static int quiet = 0;
+static int settle_band_pct = DEF_SETTLE_BAND_PCT;
+static int sample_delay = ADC_SAMPLE_DELAY;
+static double noise_lsb = 0;
+static int init_duty = -1;
+static int pwm_period = 0;	// runtime PWM period, 0 for PWM_PERIOD
+static int sample_phase = 0;	// ADC trigger phase, 0 for ADC_SAMPLE_PHASE_DEF
+
+static const char * Mode_Name(int m) {
+	return ((m >= 0) && (m < MODE_COUNT) && Mode_Names[m])? Mode_Names[m] : "?";
+}
+
+static int Mode_From_Name(const char * s) {
+	for (int m = 0; m < MODE_COUNT; m++) {
+		if (Mode_Names[m] && !strcmp(s, Mode_Names[m]))
+			return m;
+	}
+	return -1;
+}
+
+// Gaussian-ish ADC noise: sum of four uniforms from xorshift32
+static double Noise(void) {
+	static uint32_t s = 0x12345678;
+	double sum = 0;
+	for (int k = 0; k < 4; k++) {
+		s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+		sum += (s/4294967296.0) - 0.5;
+	}
+	return sum*1.7320508; // unit variance
+}
+
+static double Current_To_Ideal_Code(double i) {
+	return i*plant_params.RSense*ADC_FULL_SCALE/V_REF;
+}
+
+static uint16_t Current_To_ADC_Code(double i) {
+	double code = Current_To_Ideal_Code(i);
+	if (noise_lsb > 0)
+		code += noise_lsb*Noise();
+	if (code < 0)
+		code = 0;
+	else if (code > ADC_FULL_SCALE-1)
+		code = ADC_FULL_SCALE-1;
+	return (uint16_t) code;
+}
+
+// Result of an n-sample (hardware-averaged) conversion, and its noise-free value
+static uint16_t ADC_Result(const double * i_sample, int n, double * ideal) {
+	uint32_t sum = 0;
+	double isum = 0;
+
+	for (int j = 0; j < n; j++) {
+		sum += Current_To_ADC_Code(i_sample[j]);
+		isum += Current_To_Ideal_Code(i_sample[j]);
+	}
+	*ideal = isum/n;
+	return (uint16_t) (sum/n);
+}
+
+/* Simulate one center-aligned PWM period of 2*mod counts. The output is on
+ * while the up/down counter is below cnv, i.e. for the middle 2*cnv counts
+ * relative to the overflow. If sample_at >= 0, the currents at up to n
+ * counts sample_at + j*ADC_AVG_SPACING within the period are returned
+ * through i_sample[j]. Returns the number of samples. */
+static int Sim_PWM_Period(PLANT_T * plant, int cnv, int mod, int sample_at, int n, double * i_sample) {
+	int edge[4], k, t0, t1, ts, taken = 0;
+	const double count_s = 1.0/TPM_CLOCK_HZ;
+
+	if (cnv < 0)
+		cnv = 0;
+	else if (cnv > mod)
+		cnv = mod;
+	edge[0] = 0;
+	edge[1] = mod - cnv;
+	edge[2] = mod + cnv;
+	edge[3] = 2*mod;
+	for (k = 0; k < 3; k++) {
+		t0 = edge[k];
+		t1 = edge[k+1];
+		while ((sample_at >= 0) && (taken < n)) {
+			ts = sample_at + taken*ADC_AVG_SPACING;
+			if ((ts < t0) || (ts >= t1))
+				break;
+			Plant_Advance(plant, k == 1, (ts - t0)*count_s);
+			i_sample[taken++] = plant->I;
+			t0 = ts;
+		}
+		Plant_Advance(plant, k == 1, (t1 - t0)*count_s);
+	}
+	return taken;
+}
+
+static void Pulse_Finish(PULSE_T * p, SUMMARY_T * s, double t_end) {
+	double overshoot = 100.0*(p->MaxAvgmA - p->SetmA)/p->SetmA;
+	double ripple = p->RippleN? p->RippleSum/p->RippleN : 0;
+	double err = p->RippleN? p->ErrSum/p->RippleN : 0;
+	double swing = p->RippleN? p->SwingMax - p->SwingMin : 0;
+	double rise = (p->TFirst90 >= 0 && p->TFirst10 >= 0)? p->TFirst90 - p->TFirst10 : -1;
+	double t_last_out = p->TStart, settle;
+	int settled, i;
+
+	// Last period outside the band around the final value
+	for (i = 0; i < p->N; i++)
+		if (fabs(p->Err[i] - err) > p->SetmA*settle_band_pct/100.0)
+			t_last_out = p->TEnd[i];
+	settled = (p->TFirst90 >= 0) && (t_last_out < t_end);
+	settle = t_last_out - p->TStart;
+
+	if (overshoot < 0)
+		overshoot = 0;
+	if (!quiet) {
+		printf("  pulse %3d: set %5.1f mA  rise ", p->Count, p->SetmA);
+		if (rise >= 0) printf("%7.1f us", rise*1e6); else printf("     -- us");
+		printf("  settle(+/-%d%%) ", settle_band_pct);
+		if (settled) printf("%7.1f us", settle*1e6); else printf("     -- us");
+		printf("  overshoot %5.1f %%  ripple %6.2f mA p-p  swing %6.2f mA p-p  ss err %+6.2f mA\n",
+			overshoot, ripple, swing, err);
+	}
+	s->Pulses++;
+	if (rise >= 0)
+		s->RiseSum += rise;
+	if (settled) {
+		s->Settled++;
+		s->SettleSum += settle;
+	}
+	if (overshoot > s->WorstOvershoot)
+		s->WorstOvershoot = overshoot;
+	s->RippleSum += ripple;
+	s->SwingSum += swing;
+	s->ErrSum += err;
+	p->Active = 0;
+}
+
+// Simulated hardware and RTOS state, carried across PWM periods
+typedef struct {
+	PLANT_T Plant;
+	uint32_t Divider;			// TPM0_IRQHandler software divider
+	int Period;						// PWM period within the control period (USE_ADC_SAMPLE_PHASE)
+	long TickCounts;			// TPM counts toward the next 1 ms RTOS tick
+	double T;							// simulated time, s
+	int SetpointThread;		// run Update_Set_Current on RTOS ticks
+	double IdealSum;			// noise-free codes of the samples being decimated
+	double NoiseSq;				// sense error of each control update, LSB^2
+	long NoiseN;
+} SIM_T;
+
+static SIM_T sim;
+
+// Error of the value the control ISR reads, against the noise-free samples.
+// Samples near 0 A are skipped: the noise is clipped there.
+static void Sense_Error(uint16_t code, double ideal) {
+	if (ideal < 4*noise_lsb)
+		return;
+	sim.NoiseSq += (code - ideal)*(code - ideal);
+	sim.NoiseN++;
+}
+
+static void Sim_Reset(int setpoint_thread) {
+	Plant_Init(&sim.Plant, &plant_params);
+	sim.Divider = CTL_FREQ_DIV_FACTOR;
+	sim.Period = 0;
+	sim.TickCounts = 0;
+	sim.T = 0;
+	sim.IdealSum = sim.NoiseSq = 0;
+	sim.NoiseN = 0;
+#if USE_ADC_OVERSAMPLING
+	g_adc_decim_sum = 0;
+	g_adc_decim_n = 0;
+#endif
+	sim.SetpointThread = setpoint_thread;
+}
+
+/* Simulate one PWM period: TPM0 overflow latches CnV and the divider
+ * (TPM0_IRQHandler or the trigger timer) decides whether to convert; the
+ * conversion samples the plant and the ADC ISR runs; then the RTOS tick
+ * runs the setpoint thread and releases a full scope buffer.
+ * Returns 1 if a control update ran. sim.Plant holds the period's stats. */
+static int Sim_Period(void) {
+	double i_sample[ADC_HW_AVG_SAMPLES], ideal;
+	int mod, cnv, conv = 0, ran = 0, n, sample_at = sample_delay;
+	uint16_t code;
+
+	mod = TPM0->MOD;
+	cnv = TPM0->CONTROLS[PWM_HBLED_CHANNEL].CnV;
+#if ENABLE_OVERCURRENT_TRIP
+	if ((PORTE->PCR[HBLED_PWM_PIN] & PORT_PCR_MUX_MASK) != PORT_PCR_MUX(HBLED_PWM_MUX))
+		cnv = 0; // tripped: pin held at the off level
+#endif
+#if USE_ADC_SAMPLE_PHASE
+	{
+		int s = (g_adc_sample_phase + sample_delay) % (2*mod*CTL_FREQ_DIV_FACTOR);
+
+		conv = (sim.Period == s/(2*mod));
+		sample_at = s % (2*mod);
+		sim.Period = (sim.Period + 1) % CTL_FREQ_DIV_FACTOR;
+	}
+#elif USE_ADC_OVERSAMPLING
+	conv = 1; // TPM0_IRQHandler converts every period
+#else
+#if USE_ADAPTIVE_CTL_RATE
+	if (Control_Rate_Tick()) {
+#else
+	if (--sim.Divider == 0) {
+		sim.Divider = CTL_FREQ_DIV_FACTOR;
+#endif
+#if !USE_ADC_HW_TRIGGER
+		ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
+#endif
+		conv = 1;
+	}
+#if USE_DITHERED_PWM
+	else {
+		PWM_Dither_Step(); // TPM0_IRQHandler
+	}
+#endif
+#endif // USE_ADC_SAMPLE_PHASE
+
+#if ENABLE_OVERCURRENT_TRIP
+	if (conv)
+		Overcurrent_Disarm(); // TPM0_IRQHandler
+#endif
+	Plant_Clear_Stats(&sim.Plant);
+	n = Sim_PWM_Period(&sim.Plant, cnv, mod, conv? sample_at : -1, ADC_HW_AVG_SAMPLES, i_sample);
+
+	if (conv) {
+		// Conversion complete: result register loaded, ADC ISR runs
+		code = ADC_Result(i_sample, n, &ideal);
+		*(volatile uint32_t *) &ADC0->R[0] = code;
+		ADC0->SC1[0] |= ADC_SC1_COCO_MASK;
+#if USE_ADC_OVERSAMPLING
+		// ADC_Sense_Complete, tracking the noise-free mean
+		sim.IdealSum += ideal;
+		if (ADC_Decim_Add(code)) {
+			Sense_Error(g_adc_decim_result, sim.IdealSum/ADC_DECIM_FACTOR);
+			sim.IdealSum = 0;
+			CONTROL_HBLED();
+			ran = 1;
+		}
+#if USE_DITHERED_PWM
+		else {
+			PWM_Dither_Step();
+		}
+#endif
+#else
+		Sense_Error(code, ideal);
+		CONTROL_HBLED();
+		ran = 1;
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+		Overcurrent_Arm(); // ADC0_IRQHandler, after the control update
+#endif
+	}
+#if ENABLE_OVERCURRENT_TRIP
+	if (Overcurrent_Armed() && (Current_To_Ideal_Code(sim.Plant.IMax) >= OVERCURRENT_TRIP_CODE))
+		Overcurrent_Trip();
+#endif
+	sim.T += sim.Plant.Time;
+
+	// RTOS tick: Thread_Update_Setpoint
+	sim.TickCounts += 2*mod;
+	while (sim.TickCounts >= TICK_COUNTS) {
+		sim.TickCounts -= TICK_COUNTS;
+		if (sim.SetpointThread)
+			Update_Set_Current();
+	}
+	// Thread_Draw_Waveforms: release a full scope buffer
+	if (g_scope_state == Full) {
+#if USE_AUTOTUNE
+		Autotune_Process_Capture();
+#endif
+#if USE_SETPOINT_SHAPING
+		Shape_Process_Capture();
+#endif
+		g_scope_state = Armed;
+	}
+	return ran;
+}
+
+static void Run_Mode(int mode, int num_flashes, const SPid * pid0, const SPidFX * pidfx0, SUMMARY_T * s) {
+	PULSE_T pulse = {0};
+	double t, avg_mA, period_s;
+	int prev_set_mA = 0, set_mA;
+	struct timespec w0, w1;
+
+	memset(s, 0, sizeof(*s));
+	Sim_Reset(1);
+#if USE_RUNTIME_PWM_PERIOD
+	Control_Set_PWM_Period(PWM_PERIOD); // pid0 and pidfx0 are at PWM_PERIOD
+#endif
+	plantPID = *pid0;
+	plantPID_FX = *pidfx0;
+	plantPID_FX_GS = *pidfx0;
+#if USE_DUTY_FEEDFORWARD
+	ILC_Reset(g_ff_valid? FF_Duty(g_peak_set_current_mA) : 0);
+#else
+	ILC_Reset(0);
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+	Overcurrent_Clear();
+	g_enable_control = 1;
+	s->Trips = -g_overcurrent_trips;
+#endif
+	Control_Set_Mode((CTL_MODE_E) mode);
+#if USE_RUNTIME_PWM_PERIOD
+	if (pwm_period && !Control_Set_PWM_Period(pwm_period) && !quiet)
+		printf("  %s stays at PWM_PERIOD %d\n", Mode_Name(mode), PWM_PERIOD);
+#endif
+	g_duty_cycle = (init_duty >= 0)? init_duty : 5;
+#if USE_DITHERED_PWM
+	PWM_Dither_Set(g_duty_cycle);
+	g_pwm_dither_err = 0;
+#endif
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
+
+	clock_gettime(CLOCK_MONOTONIC, &w0);
+	while (pulse.Count < num_flashes || pulse.Active) {
+		// Pulse metrics use the setpoint in force during this period
+		set_mA = g_set_current_mA;
+		t = sim.T;
+		s->Periods++;
+		s->Steps += Sim_Period();
+		period_s = sim.Plant.Time;
+
+		avg_mA = 1000.0*sim.Plant.Charge/period_s;
+		if ((prev_set_mA <= 0) && (set_mA > 0) && (pulse.Count < num_flashes)) {
+			int n = pulse.Count + 1;
+			memset(&pulse, 0, sizeof(pulse));
+			pulse.Active = 1;
+			pulse.Count = n;
+			pulse.SetmA = set_mA;
+			pulse.TStart = t;
+			pulse.TFirst10 = pulse.TFirst90 = -1;
+			pulse.TMid = t + g_flash_duration*1e-3/2;
+		} else if (pulse.Active && (set_mA <= 0)) {
+			Pulse_Finish(&pulse, s, t);
+		}
+		if (pulse.Active) {
+			if ((pulse.TFirst10 < 0) && (avg_mA >= 0.1*pulse.SetmA))
+				pulse.TFirst10 = t;
+			if ((pulse.TFirst90 < 0) && (avg_mA >= 0.9*pulse.SetmA))
+				pulse.TFirst90 = t;
+			if (pulse.N < PULSE_MAX_PERIODS) {
+				pulse.Err[pulse.N] = avg_mA - set_mA;
+				pulse.TEnd[pulse.N++] = t + period_s;
+			}
+			if (avg_mA > pulse.MaxAvgmA)
+				pulse.MaxAvgmA = avg_mA;
+			if (t >= pulse.TMid) {
+				pulse.RippleSum += 1000.0*(sim.Plant.IMax - sim.Plant.IMin);
+				pulse.ErrSum += avg_mA - set_mA; // tracks a shaped pulse
+				if (!pulse.RippleN || (avg_mA - set_mA < pulse.SwingMin))
+					pulse.SwingMin = avg_mA - set_mA;
+				if (!pulse.RippleN || (avg_mA - set_mA > pulse.SwingMax))
+					pulse.SwingMax = avg_mA - set_mA;
+				pulse.RippleN++;
+			}
+		}
+		prev_set_mA = set_mA;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &w1);
+	s->WallSec = (w1.tv_sec - w0.tv_sec) + (w1.tv_nsec - w0.tv_nsec)*1e-9;
+	s->NoiseSq = sim.NoiseSq;
+	s->NoiseN = sim.NoiseN;
+#if ENABLE_OVERCURRENT_TRIP
+	s->Trips += g_overcurrent_trips;
+#endif
+}
+
+#if USE_DUTY_FEEDFORWARD
+// Startup feedforward sweep, as main() runs it before the RTOS starts
+static void Learn_Feedforward(void) {
+	Sim_Reset(0);
+	FF_Learn_Start();
+	while (FF_Learning())
+		Sim_Period();
+	if (!quiet) {
+		printf("Feedforward sweep %d ms (%.1f ms simulated)\n  mA duty:", g_ff_learn_ms, sim.T*1e3);
+		for (int k = 0; k < FF_ENTRIES; k++)
+			printf("%s%d %d", (k % 8)? ",  " : "\n    ", k*FF_STEP_mA, g_ff_duty_table[k]);
+		printf("\n");
+	}
+}
+#endif
+
+#if USE_AUTOTUNE
+#define AT_SIM_MAX_FLASHES (20)
+// Relay autotune (-A), as started from the UI: returns tuned gains in *pidfx
+static int Run_Autotune(SPidFX * pidfx) {
+	int flashes = 0, prev_set_mA = 0;
+
+	Sim_Reset(1);
+	plantPID_FX = *pidfx;
+	Control_Set_Mode(PID_FX);
+	g_duty_cycle = 0;
+	Autotune_Start();
+	while (Autotune_Running() && (flashes < AT_SIM_MAX_FLASHES)) {
+		Sim_Period();
+		if ((prev_set_mA <= 0) && (g_set_current_mA > 0))
+			flashes++;
+		prev_set_mA = g_set_current_mA;
+	}
+	if (g_autotune_state != AT_Done) {
+		printf("Autotune failed after %d flashes\n", flashes);
+		return 1;
+	}
+	printf("Autotune at %d mA: %d flashes (%.2f s simulated), bias %d\n", g_peak_set_current_mA,
+		flashes, sim.T, g_autotune_bias);
+	printf("  Ku %.3f counts/mA  Tu %d us\n", FX_TO_FL(g_autotune_ku), g_autotune_tu_us);
+	printf("  pGain %d (%.4f)  iGain %d  dGain %d (%.4f)  settle %d us\n",
+		plantPID_FX.pGain, FX_TO_FL(plantPID_FX.pGain), plantPID_FX.iGain,
+		plantPID_FX.dGain, FX_TO_FL(plantPID_FX.dGain), g_autotune_settle_us);
+	*pidfx = plantPID_FX;
+	pidfx->iState = pidfx->dState = 0;
+	return 0;
+}
+#endif
+
+static void Print_Summary(int mode, const SUMMARY_T * s) {
+	char settle[16] = "     --";
+
+	if (s->Settled)
+		snprintf(settle, sizeof(settle), "%7.1f", 1e6*s->SettleSum/s->Settled);
+	printf("%-12s pulses %d  rise %7.1f us  settle %s us (%d/%d)  worst overshoot %5.1f %%  ripple %6.2f mA  swing %6.2f mA  ss err %+6.2f mA  %.2f M steps/s\n",
+		Mode_Name(mode), s->Pulses,
+		s->Pulses? 1e6*s->RiseSum/s->Pulses : 0,
+		settle, s->Settled, s->Pulses, s->WorstOvershoot,
+		s->Pulses? s->RippleSum/s->Pulses : 0,
+		s->Pulses? s->SwingSum/s->Pulses : 0,
+		s->Pulses? s->ErrSum/s->Pulses : 0,
+		s->WallSec > 0? s->Steps/s->WallSec/1e6 : 0);
+	printf("%-12s control updates %ld of %ld PWM periods (%.1f %% skipped)\n", "",
+		s->Steps, s->Periods, s->Periods? 100.0*(s->Periods - s->Steps)/s->Periods : 0);
+	if ((noise_lsb > 0) || USE_ADC_OVERSAMPLING || (ADC_HW_AVG_SAMPLES > 1)) {
+		double rms = s->NoiseN? sqrt(s->NoiseSq/s->NoiseN) : 0;
+#if USE_ADC_OVERSAMPLING
+		int decim = ADC_DECIM_FACTOR;
+#else
+		int decim = 1;
+#endif
+		printf("%-12s sense noise %.2f LSB rms (%.4f mA), %d x %d conversions of %.1f us per update\n", "",
+			rms, rms*V_REF*1000/(ADC_FULL_SCALE*plant_params.RSense),
+			decim, ADC_HW_AVG_SAMPLES,
+			ADC_CONV_TIME_NS(ADC_HW_AVG_SAMPLES)/1000.0);
+	}
+#if ENABLE_OVERCURRENT_TRIP
+	printf("%-12s overcurrent trips %d (limit %d mA)\n", "", s->Trips, OVERCURRENT_TRIP_mA);
+#endif
+}
+
+/* Gain table characterization (-G). At each Gain_Sched_Table breakpoint,
+ * flash the LED to that current under PID_FX with a grid of multiples of
+ * the default P and I gains and score every pair: rise and settling time
+ * plus penalties for overshoot, steady-state error and ripple. Overshoot
+ * and ripple dominate, so a pair that limit-cycles never wins on rise time.
+ * A pulse that never settles counts as settling at its end.
+ * The table is then the sequence of pairs with the lowest total cost in
+ * which neighbouring breakpoints differ by at most one grid step (a factor
+ * of 1.41) in each gain, plus GS_STEP_US per step, so interpolating between
+ * breakpoints stays between two characterized, similar gain sets.
+ * The 0 mA breakpoint is characterized at GS_MIN_mA. */
+#define GS_MIN_mA						(4)
+#define GS_FLASHES					(3)
+#define GS_FLASH_PERIOD_MS	(40)
+#define GS_OVERSHOOT_US			(10.0)	// cost per % overshoot, us of rise time
+#define GS_ERROR_US					(5.0)	// cost per % steady-state error
+#define GS_RIPPLE_US				(20.0)	// cost per % ripple
+#define GS_SETTLE_WT				(0.1)		// cost per us of settling time
+#define GS_STEP_US					(20.0)	// cost per grid step between breakpoints
+static const double GS_Multipliers[] = {0.25, 0.35, 0.5, 0.71, 1.0, 1.41, 2.0, 2.83, 4.0, 5.66, 8.0};
+#define GS_NUM_MULT ((int)(sizeof(GS_Multipliers)/sizeof(GS_Multipliers[0])))
+#define GS_NUM_PAIRS (GS_NUM_MULT*GS_NUM_MULT)
+
+typedef struct {
+	double Cost, Rise, Settle, Overshoot, Ripple, Err;	// us, us, us, %, mA p-p, mA
+	double Total;				// lowest cost of breakpoints 0..k ending in this pair
+	int Prev;						// pair index at breakpoint k-1 on that path
+} GS_POINT_T;
+
+static void Gain_Sched_Score(GS_POINT_T * pt, const SUMMARY_T * s, double set_mA) {
+	if (s->Pulses == 0) {
+		pt->Cost = 1e12;
+		return;
+	}
+	pt->Rise = 1e6*s->RiseSum/s->Pulses;
+	// Unsettled pulses count as settling at the end of the pulse
+	pt->Settle = 1e6*(s->SettleSum + (s->Pulses - s->Settled)*g_flash_duration*1e-3)/s->Pulses;
+	pt->Overshoot = s->WorstOvershoot;
+	pt->Ripple = s->RippleSum/s->Pulses;
+	pt->Err = s->ErrSum/s->Pulses;
+	pt->Cost = pt->Rise + GS_SETTLE_WT*pt->Settle + GS_OVERSHOOT_US*pt->Overshoot
+		+ GS_ERROR_US*100.0*fabs(pt->Err)/set_mA + GS_RIPPLE_US*100.0*pt->Ripple/set_mA;
+}
+
+static int Generate_Gain_Table(const char * path, const SPid * pid0, const SPidFX * pidfx0) {
+	static GS_POINT_T grid[GAIN_SCHED_ENTRIES][GS_NUM_PAIRS];
+	GAIN_SCHED_ENTRY_T tab[GAIN_SCHED_ENTRIES];
+	int pair[GAIN_SCHED_ENTRIES];
+	SPidFX pid;
+	SUMMARY_T s;
+	GS_POINT_T * pt;
+	double total;
+	int k, j, q, ip, ii, set_mA;
+	int saved_peak = g_peak_set_current_mA, saved_period = g_flash_period, saved_quiet = quiet;
+	FILE * f;
+
+	quiet = 1;
+	g_flash_period = GS_FLASH_PERIOD_MS;
+	for (k = 0; k < GAIN_SCHED_ENTRIES; k++) {
+		set_mA = (k == 0)? GS_MIN_mA : k*GAIN_SCHED_STEP_mA;
+		g_peak_set_current_mA = set_mA;
+		for (j = 0; j < GS_NUM_PAIRS; j++) {
+			pid = *pidfx0;
+			pid.pGain = (FX16_16)(pidfx0->pGain*GS_Multipliers[j/GS_NUM_MULT]);
+			pid.iGain = (FX16_16)(pidfx0->iGain*GS_Multipliers[j%GS_NUM_MULT]);
+			Run_Mode(PID_FX, GS_FLASHES, pid0, &pid, &s);
+			pt = &grid[k][j];
+			Gain_Sched_Score(pt, &s, set_mA);
+			// Cheapest path from breakpoint k-1 through a pair at most one step away
+			pt->Total = pt->Cost;
+			pt->Prev = -1;
+			if (k == 0)
+				continue;
+			pt->Total += 1e12;
+			for (q = 0; q < GS_NUM_PAIRS; q++) {
+				ip = abs(q/GS_NUM_MULT - j/GS_NUM_MULT);
+				ii = abs(q%GS_NUM_MULT - j%GS_NUM_MULT);
+				if ((ip > 1) || (ii > 1))
+					continue;
+				total = grid[k-1][q].Total + GS_STEP_US*(ip + ii) + pt->Cost;
+				if ((pt->Prev < 0) || (total < pt->Total)) {
+					pt->Total = total;
+					pt->Prev = q;
+				}
+			}
+		}
+	}
+	g_peak_set_current_mA = saved_peak;
+	g_flash_period = saved_period;
+	quiet = saved_quiet;
+
+	// Trace the cheapest path back from the last breakpoint
+	for (j = 0, q = 1; q < GS_NUM_PAIRS; q++) {
+		if (grid[GAIN_SCHED_ENTRIES-1][q].Total < grid[GAIN_SCHED_ENTRIES-1][j].Total)
+			j = q;
+	}
+	for (k = GAIN_SCHED_ENTRIES-1; k >= 0; k--) {
+		pair[k] = j;
+		j = grid[k][j].Prev;
+	}
+	for (k = 0; k < GAIN_SCHED_ENTRIES; k++) {
+		j = pair[k];
+		tab[k].pGain = (FX16_16)(pidfx0->pGain*GS_Multipliers[j/GS_NUM_MULT]);
+		tab[k].iGain = (FX16_16)(pidfx0->iGain*GS_Multipliers[j%GS_NUM_MULT]);
+		tab[k].dGain = pidfx0->dGain;
+		pt = &grid[k][j];
+		fprintf(stderr, "%4d mA: P x%4.2f  I x%4.2f  rise %6.1f us  settle %7.1f us  overshoot %5.1f %%"
+			"  ripple %6.2f mA p-p  ss err %+6.2f mA\n", (k == 0)? GS_MIN_mA : k*GAIN_SCHED_STEP_mA,
+			GS_Multipliers[j/GS_NUM_MULT], GS_Multipliers[j%GS_NUM_MULT],
+			pt->Rise, pt->Settle, pt->Overshoot, pt->Ripple, pt->Err);
+	}
+
+	if ((f = fopen(path, "w")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	fprintf(f, "// Generated by Simulator/hbled_sim -G (make -C Simulator gain-table). Do not edit.\n"
+		"// Plant: VIn %.2f V, L %.0f uH, LED %.2f V + %.2f ohm, RSense %.2f ohm\n"
+		"#include \"gain_sched.h\"\n\n"
+		"#define GAIN_SCHED_TABLE_CTL_PERIOD (%d)\n"
+		"#if GAIN_SCHED_TABLE_CTL_PERIOD != CTL_PERIOD\n"
+		"#error \"Gain_Sched_Table was characterized at another CTL_PERIOD; regenerate it\"\n"
+		"#endif\n\n"
+		"const GAIN_SCHED_ENTRY_T Gain_Sched_Table[GAIN_SCHED_ENTRIES] = {\n"
+		"\t// pGain, iGain, dGain\n",
+		plant_params.VIn, plant_params.L*1e6, plant_params.VLED, plant_params.RLED, plant_params.RSense,
+		CTL_PERIOD);
+	for (k = 0; k < GAIN_SCHED_ENTRIES; k++)
+		fprintf(f, "\t{%ld, %ld, %ld}, // %3d mA\n", (long) tab[k].pGain, (long) tab[k].iGain,
+			(long) tab[k].dGain, k*GAIN_SCHED_STEP_mA);
+	fprintf(f, "};\n");
+	fclose(f);
+	return 0;
+}
+
+/* Deadbeat table characterization (-M). At each Deadbeat_Table operating
+ * point, find the OpenLoop duty cycle whose sampled current is the
+ * operating current, then drive the duty cycle with a pseudo-random
+ * +/- DB_DITHER sequence around it and fit
+ *   i[k+1] = a*i[k] + b1*u[k-1] + b2*u[k] + c
+ * by least squares to the samples the control ISR sees. Solving the model
+ * for i[k+1] = set gives the table's affine law.
+ * Within a conduction period the model is CTL_FREQ_DIV_FACTOR repetitions
+ * of a one-PWM-period step i' = alpha*i + beta*u + gamma, with u[k-1]
+ * driving the first one. The step at the flash current's operating point
+ * is written as Current_Predictor (predictor.h). */
+#define DB_SETTLE_UPDATES		(400)		// control updates to settle at a duty cycle
+#define DB_AVG_UPDATES			(100)		// control updates averaged
+#define DB_FIT_UPDATES			(4000)	// control updates of dithered data per fit
+#define DB_DITHER						(16)		// duty cycle counts
+#define DB_COEF_MAX					(32.0)	// |gain| limit, keeps the ISR products in 32 bits
+
+// Hold duty for n control updates; returns the mean sampled current, mA
+static double DB_Hold(int duty, int n) {
+	double sum = 0;
+	int k = 0;
+
+	g_duty_cycle = duty;
+	while (k < n) {
+		if (Sim_Period()) {
+			if (k++ >= n - DB_AVG_UPDATES)
+				sum += g_measured_current_mA;
+		}
+	}
+	return sum/DB_AVG_UPDATES;
+}
+
+// From rest, write duty at one control update; returns the current
+// sampled at the next one, mA
+static int DB_Step_From_Rest(int duty) {
+	Sim_Reset(0);
+	DB_Hold(0, DB_AVG_UPDATES);
+	g_duty_cycle = duty;
+	while (!Sim_Period())
+		;
+	g_duty_cycle = 0;
+	while (!Sim_Period())
+		;
+	return g_measured_current_mA;
+}
+
+// Solve the 4x4 system m*x = v by Gaussian elimination with partial pivoting
+static int DB_Solve(double m[4][4], double v[4], double x[4]) {
+	int r, c, p, j;
+	double t;
+
+	for (c = 0; c < 4; c++) {
+		for (p = c, r = c+1; r < 4; r++)
+			if (fabs(m[r][c]) > fabs(m[p][c]))
+				p = r;
+		if (fabs(m[p][c]) < 1e-12)
+			return 0;
+		for (j = 0; j < 4; j++) {
+			t = m[c][j]; m[c][j] = m[p][j]; m[p][j] = t;
+		}
+		t = v[c]; v[c] = v[p]; v[p] = t;
+		for (r = c+1; r < 4; r++) {
+			t = m[r][c]/m[c][c];
+			for (j = c; j < 4; j++)
+				m[r][j] -= t*m[c][j];
+			v[r] -= t*v[c];
+		}
+	}
+	for (r = 3; r >= 0; r--) {
+		t = v[r];
+		for (j = r+1; j < 4; j++)
+			t -= m[r][j]*x[j];
+		x[r] = t/m[r][r];
+	}
+	return 1;
+}
+
+static FX16_16 DB_Coef_FX(double c, double max) {
+	if (c > max)
+		c = max;
+	else if (c < -max)
+		c = -max;
+	return (FX16_16) lround(c*65536.0);
+}
+
+static int Generate_Deadbeat_Table(const char * path) {
+	DEADBEAT_ENTRY_T tab[DEADBEAT_ENTRIES] = {{0}};
+	double m[4][4], v[4], x[4], row[4], a, b1, b2, c, i_mA, alpha, pw;
+	CURRENT_PREDICTOR_T pred = {0};
+	int k, n, r, j, lo, hi, mid, u, u_prev, u_ss, u_off, i_prev, pred_mA = 0;
+	uint32_t prbs = 0xACE1;
+	FILE * f;
+
+	Control_Set_Mode(OpenLoop);
+	for (k = 1; k < DEADBEAT_ENTRIES; k++) {
+		// Rising edge region: bisect for the duty cycle reaching the current in one period
+		for (lo = 0, hi = LIM_DUTY_CYCLE; hi - lo > 1; ) {
+			mid = (lo + hi)/2;
+			if (DB_Step_From_Rest(mid) < k*DEADBEAT_STEP_mA)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		u_off = hi;
+
+		Sim_Reset(0);
+		// Operating point: bisect for the duty cycle giving k*DEADBEAT_STEP_mA
+		for (lo = 0, hi = LIM_DUTY_CYCLE; hi - lo > 1; ) {
+			mid = (lo + hi)/2;
+			if (DB_Hold(mid, DB_SETTLE_UPDATES) < k*DEADBEAT_STEP_mA)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		u_ss = hi;
+		DB_Hold(u_ss, DB_SETTLE_UPDATES);
+
+		// Dithered run and normal equations of the fit
+		memset(m, 0, sizeof(m));
+		memset(v, 0, sizeof(v));
+		u_prev = u = u_ss;
+		i_prev = g_measured_current_mA;
+		for (n = 0; n < DB_FIT_UPDATES; ) {
+			if (!Sim_Period())
+				continue;
+			// ISR measured i[k], then wrote g_duty_cycle. u and u_prev were
+			// written at k-1 and k-2.
+			i_mA = g_measured_current_mA;
+			if (n++ > 0) {
+				row[0] = i_prev; row[1] = u_prev; row[2] = u; row[3] = 1;
+				for (r = 0; r < 4; r++) {
+					for (j = 0; j < 4; j++)
+						m[r][j] += row[r]*row[j];
+					v[r] += row[r]*i_mA;
+				}
+			}
+			u_prev = u;
+			u = g_duty_cycle;
+			i_prev = (int) i_mA;
+			prbs = (prbs >> 1) ^ (-(prbs & 1u) & 0xB400u); // 16-bit Galois LFSR
+			g_duty_cycle = u_ss + ((prbs & 1)? DB_DITHER : -DB_DITHER);
+			if (g_duty_cycle > LIM_DUTY_CYCLE)
+				g_duty_cycle = LIM_DUTY_CYCLE;
+		}
+		if (!DB_Solve(m, v, x) || (fabs(x[2]) < 1e-6)) {
+			fprintf(stderr, "%4d mA: fit failed\n", k*DEADBEAT_STEP_mA);
+			return 1;
+		}
+		a = x[0]; b1 = x[1]; b2 = x[2]; c = x[3];
+		tab[k].C0 = DB_Coef_FX(-c/b2, 16*LIM_DUTY_CYCLE);
+		tab[k].CSet = DB_Coef_FX(1/b2, DB_COEF_MAX);
+		tab[k].CMeas = DB_Coef_FX(-a/b2, DB_COEF_MAX);
+		tab[k].CPrev = DB_Coef_FX(-b1/b2, DB_COEF_MAX);
+		tab[k].COff = DB_Coef_FX(u_off - k*DEADBEAT_STEP_mA/b2, 16*LIM_DUTY_CYCLE);
+		fprintf(stderr, "%4d mA: duty %3d  a %6.3f  b1 %6.3f  b2 %6.3f mA/count  c %8.2f mA  from rest %3d\n",
+			k*DEADBEAT_STEP_mA, u_ss, a, b1, b2, c, u_off);
+		if (k == (FLASH_CURRENT_MA + DEADBEAT_STEP_mA/2) >> DEADBEAT_SHIFT) {
+			pred_mA = k*DEADBEAT_STEP_mA;
+			// a = alpha^N, b1 = alpha^(N-1)*beta, c = gamma*(1 + alpha + ... + alpha^(N-1))
+			alpha = pow(a, 1.0/CTL_FREQ_DIV_FACTOR);
+			for (pw = 0, j = 0; j < CTL_FREQ_DIV_FACTOR; j++)
+				pw += pow(alpha, j);
+			pred.Alpha = DB_Coef_FX(alpha, 1.0);
+			pred.Beta = DB_Coef_FX(b1/pow(alpha, CTL_FREQ_DIV_FACTOR-1), DB_COEF_MAX);
+			pred.Gamma = DB_Coef_FX(c/pw, 16*LIM_DUTY_CYCLE);
+			fprintf(stderr, "  predictor: alpha %6.3f  beta %6.3f mA/count  gamma %8.2f mA\n",
+				FX_TO_FL(pred.Alpha), FX_TO_FL(pred.Beta), FX_TO_FL(pred.Gamma));
+		}
+	}
+
+	if ((f = fopen(path, "w")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	fprintf(f, "// Generated by Simulator/hbled_sim -M (make -C Simulator deadbeat-table). Do not edit.\n"
+		"// Plant: VIn %.2f V, L %.0f uH, LED %.2f V + %.2f ohm, RSense %.2f ohm\n"
+		"#include \"deadbeat.h\"\n"
+		"#include \"predictor.h\"\n\n"
+		"#define DEADBEAT_TABLE_CTL_PERIOD (%d)\n"
+		"#if DEADBEAT_TABLE_CTL_PERIOD != CTL_PERIOD\n"
+		"#error \"Deadbeat_Table was characterized at another CTL_PERIOD; regenerate it\"\n"
+		"#endif\n\n"
+		"const DEADBEAT_ENTRY_T Deadbeat_Table[DEADBEAT_ENTRIES] = {\n"
+		"\t// C0, CSet, CMeas, CPrev, COff\n",
+		plant_params.VIn, plant_params.L*1e6, plant_params.VLED, plant_params.RLED, plant_params.RSense,
+		CTL_PERIOD);
+	for (k = 0; k < DEADBEAT_ENTRIES; k++)
+		fprintf(f, "\t{%ld, %ld, %ld, %ld, %ld}, // %3d mA\n", (long) tab[k].C0, (long) tab[k].CSet,
+			(long) tab[k].CMeas, (long) tab[k].CPrev, (long) tab[k].COff, k*DEADBEAT_STEP_mA);
+	fprintf(f, "};\n\n"
+		"// One PWM period at the %d mA operating point, nearest FLASH_CURRENT_MA\n"
+		"const CURRENT_PREDICTOR_T Current_Predictor = {%ld, %ld, %ld}; // Alpha, Beta, Gamma\n",
+		pred_mA, (long) pred.Alpha, (long) pred.Beta, (long) pred.Gamma);
+	fclose(f);
+	return 0;
+}
+
+static void Usage(const char * prog) {
+	printf("Usage: %s [options]\n"
+		"  -m mode     control mode name, or 'all' (default %s)\n"
+		"  -f n        number of flash pulses to measure (default %d)\n"
+		"  -p mA       peak flash current (default %d)\n"
+		"  -w ms       flash duration (default %d)\n"
+		"  -t ms       flash period (default %d)\n"
+		"  -D counts   initial duty cycle (OpenLoop operating point)\n"
+		"  -b pct      settling band around the final value, +/- percent of setpoint (default %d)\n"
+		"  -d counts   ADC sample delay after TPM overflow (default %d)\n"
+		"  -n lsb      ADC noise, rms LSBs (default 0)\n"
+		"  -V volts    supply voltage (default %.2f)\n"
+		"  -L uH       inductance (default %.0f)\n"
+		"  -q          summary only\n"
+		"  -G file     characterize the plant and write the PID_FX_GS gain table\n"
+		"  -M file     identify the plant model, write the Deadbeat law and current predictor\n"
+		"  -A          relay-autotune PID_FX, then run it (USE_AUTOTUNE)\n"
+		"  -S n        setpoint shaping profile: 0 none, 1 overdrive, 2 ramp, 3 inverse\n"
+		"              (USE_SETPOINT_SHAPING)\n"
+		"  -P counts   switch to this PWM period from PWM_PERIOD_TABLE (USE_RUNTIME_PWM_PERIOD)\n"
+		"  -a counts   ADC trigger phase after the TPM0 overflow, 48 MHz counts (USE_ADC_SAMPLE_PHASE)\n"
+		"  -W n        setpoint waveform: 0 rectangle, 1 ramp, 2 trapezoid, 3 sine, 4 user\n"
+		"  -e pct      trapezoid edge, percent of the pulse (default %d)\n",
+		prog, Mode_Name(DEF_CONTROL_MODE), DEF_NUM_FLASHES, FLASH_CURRENT_MA, FLASH_DURATION_MS,
+		FLASH_PERIOD_MS, DEF_SETTLE_BAND_PCT, ADC_SAMPLE_DELAY, PLANT_DEF_V_IN, PLANT_DEF_L*1e6,
+		WAVE_DEF_EDGE_PCT);
+}
+
+int main(int argc, char * argv[]) {
+	int opt, mode = DEF_CONTROL_MODE, all = 0, num_flashes = DEF_NUM_FLASHES;
+	const char * table_path = NULL, * deadbeat_path = NULL;
+	int autotune = 0, shape = -1;
+	SPid pid0;
+	SPidFX pidfx0;
+	SUMMARY_T s;
+
+	Plant_Default_Params(&plant_params);
+	while ((opt = getopt(argc, argv, "m:f:p:w:t:D:b:d:n:V:L:qG:M:AS:P:a:W:e:h")) != -1) {
+		switch (opt) {
+			case 'm':
+				if (!strcmp(optarg, "all")) {
+					all = 1;
+				} else if ((mode = Mode_From_Name(optarg)) < 0) {
+					fprintf(stderr, "Unknown mode %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'f': num_flashes = atoi(optarg); break;
+			case 'p': g_peak_set_current_mA = atoi(optarg); break;
+			case 'w': g_flash_duration = atoi(optarg); break;
+			case 't': g_flash_period = atoi(optarg); break;
+			case 'D': init_duty = atoi(optarg); break;
+			case 'b': settle_band_pct = atoi(optarg); break;
+			case 'd': sample_delay = atoi(optarg); break;
+			case 'n': noise_lsb = atof(optarg); break;
+			case 'V': plant_params.VIn = atof(optarg); break;
+			case 'L': plant_params.L = atof(optarg)*1e-6; break;
+			case 'q': quiet = 1; break;
+			case 'G': table_path = optarg; break;
+			case 'M': deadbeat_path = optarg; break;
+			case 'A': autotune = 1; break;
+			case 'S': shape = atoi(optarg); break;
+			case 'P': pwm_period = atoi(optarg); break;
+			case 'a': sample_phase = atoi(optarg); break;
+			case 'W': g_wave_shape = atoi(optarg); break;
+			case 'e': g_wave_edge_pct = atoi(optarg); break;
+			default:
+				Usage(argv[0]);
+				return (opt == 'h')? 0 : 1;
+		}
+	}
+
+	Init_Buck_HBLED();
+	if (shape >= 0) {
+#if USE_SETPOINT_SHAPING
+		Shape_Select((SHAPE_PROFILE_E) shape);
+#else
+		fprintf(stderr, "-S needs USE_SETPOINT_SHAPING in control.h\n");
+		return 1;
+#endif
+	}
+	if (sample_phase) {
+#if USE_ADC_SAMPLE_PHASE
+		Control_Set_Sample_Phase(sample_phase);
+#else
+		fprintf(stderr, "-a needs USE_ADC_SAMPLE_PHASE in control.h\n");
+		return 1;
+#endif
+	}
+	if (pwm_period) {
+#if USE_RUNTIME_PWM_PERIOD
+		const int16_t periods[] = PWM_PERIOD_TABLE;
+		int i;
+		for (i = 0; (i < sizeof(periods)/sizeof(periods[0])) && (periods[i] != pwm_period); i++)
+			;
+		if (i >= sizeof(periods)/sizeof(periods[0])) {
+			fprintf(stderr, "PWM period %d is not in PWM_PERIOD_TABLE\n", pwm_period);
+			return 1;
+		}
+#else
+		fprintf(stderr, "-P needs USE_RUNTIME_PWM_PERIOD in control.h\n");
+		return 1;
+#endif
+	}
+#if USE_DUTY_FEEDFORWARD
+	Learn_Feedforward();
+#endif
+	pid0 = plantPID;
+	pidfx0 = plantPID_FX;
+	if (table_path)
+		return Generate_Gain_Table(table_path, &pid0, &pidfx0);
+	if (deadbeat_path)
+		return Generate_Deadbeat_Table(deadbeat_path);
+	if (autotune) {
+#if USE_AUTOTUNE
+		if (Run_Autotune(&pidfx0))
+			return 1;
+		mode = PID_FX;
+		all = 0;
+#else
+		fprintf(stderr, "-A needs USE_AUTOTUNE in control.h\n");
+		return 1;
+#endif
+	}
+
+	for (int m = all? 0 : mode; m < (all? MODE_COUNT : mode+1); m++) {
+		if (all && (m == Autotune))
+			continue; // relay experiment, not a closed-loop mode
+		if (!quiet)
+			printf("%s:\n", Mode_Name(m));
+		Run_Mode(m, num_flashes, &pid0, &pidfx0, &s);
+		Print_Summary(m, &s);
+	}
+	return 0;
+}
@@ -14,9 +14,42 @@
 #include "UI.h"
 #include "FX.h"
 #include "ADC.h"
+#if USE_ADC_OVERSAMPLING
+#include "adc_decim.h"
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+#include "overcurrent.h"
+#endif
 
 osMessageQueueId_t  ADC_RequestQueue;
-osMessageQueueId_t  ADC_ResponseQueue;
+volatile ADC_STATS_T g_adc_stats;
+
+/* Self-calibration (KL25 RM 28.4.6). Run with the ADC idle, before hardware
+ * triggers and interrupts are set up: ADCK 3 MHz (bus/2/4), long sample,
+ * 32 conversions averaged, software trigger. The hardware loads OFS; the
+ * plus- and minus-side gains are half the sums of the calibration results
+ * with the MSB set. The caller applies its conversion profile afterwards. */
+int ADC_Calibrate(void) {
+	uint16_t cal;
+
+	SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK; 
+	ADC0->CFG1 = ADC_CFG1_ADIV(2) | ADC_CFG1_ADLSMP_MASK | ADC_CFG1_MODE(3) | ADC_CFG1_ADICLK(1);
+	ADC0->CFG2 = 0;
+	ADC0->SC2 = ADC_SC2_REFSEL(0); // software trigger
+	ADC0->SC3 = ADC_SC3_CAL_MASK | ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(3);
+	while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK))
+		; // calibration done
+	if (ADC0->SC3 & ADC_SC3_CALF_MASK) {
+		ADC0->SC3 = ADC_SC3_CALF_MASK; // write 1 to clear
+		return 0;
+	}
+	cal = ADC0->CLP0 + ADC0->CLP1 + ADC0->CLP2 + ADC0->CLP3 + ADC0->CLP4 + ADC0->CLPS;
+	ADC0->PG = (cal >> 1) | 0x8000;
+	cal = ADC0->CLM0 + ADC0->CLM1 + ADC0->CLM2 + ADC0->CLM3 + ADC0->CLM4 + ADC0->CLMS;
+	ADC0->MG = (cal >> 1) | 0x8000;
+	ADC0->SC3 = 0;
+	return 1;
+}
 
 void ADC_Update_MuxSel(uint32_t m) {
 	if (m)
@@ -27,49 +60,164 @@ void ADC_Update_MuxSel(uint32_t m) {
 
 #if USE_ADC_INTERRUPT
 #if USE_ADC_SERVER        // moved to ADC.c to keep everything together.
+// TPM counts left before the next control conversion starts
+__STATIC_FORCEINLINE int ADC_Window_Left(void) {
+	volatile uint16_t t2;
+	int diff;
+
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	// Up-counting trigger timer: counts left until it starts the next control conversion
+	t2=CTL_TRIGGER_TPM->CNT;
+	diff=(int)CTL_TRIGGER_TPM->MOD-(int)t2;
+#else
+	volatile uint16_t t1=TPM0->CNT;
+	t2=TPM0->CNT;
+	diff=PWM_PERIOD_NOW-(int)t2;
+	if (t2 < t1) diff+=PWM_PERIOD_NOW;   // if cnt down, add a full PWM period to counts left.
+#if USE_SYNC_SW_CTL_FREQ_DIV && !USE_ADAPTIVE_CTL_RATE && !USE_ADC_OVERSAMPLING
+	// Overflows before the one that starts the control conversion only count down
+	diff+=((int)g_ctl_divider-1)*2*PWM_PERIOD_NOW;
+#endif
+#endif
+	return diff;
+}
+
+static ADC_Request_t * adc_pending[ADC_PENDING_MAX]; // dequeued requests, NULL if free
+static int adc_cur;                   // adc_pending slot converting now
+
+// Move requests from the queue into free pending slots. Stops polling at
+// the first empty get: each get is a kernel call inside the control window.
+__STATIC_FORCEINLINE int ADC_Fill_Pending(void) {
+	int i, n=0, empty=0;
+
+	for (i=0; i<ADC_PENDING_MAX; i++) {
+		if ((adc_pending[i] == NULL) && !empty
+			&& (osMessageQueueGet(ADC_RequestQueue,&adc_pending[i],NULL,0) != osOK)) {
+			adc_pending[i] = NULL;            // queue empty
+			empty = 1;
+		}
+		n += (adc_pending[i] != NULL);
+	}
+	return n;
+}
+
+// A request that didn't come through ADC_Submit (no profile or thread, or a
+// bad count) would configure the ADC from address 0 or write past Sample[]
+__STATIC_FORCEINLINE int ADC_Request_Valid(const ADC_Request_t * r) {
+	return (r->Count >= 1) && (r->Count <= ADC_BATCH_MAX) && (r->Next < r->Count)
+		&& (r->Conv[r->Next].Profile != NULL) && (r->Thread != NULL);
+}
+
+/* Start the pending conversion that fits in the window left before the next
+ * control conversion, earliest deadline first. Each request's conversions
+ * run in order; those of different requests can interleave and share a
+ * window. Malformed requests are dropped. Returns 0 if none fits. */
+__STATIC_FORCEINLINE int ADC_Start_Lopri(void) {
+	ADC_Request_t * r;
+	const ADC_Conv_t * conv;
+	int i, best=-1, left=ADC_Window_Left();
+
+	for (i=0; i<ADC_PENDING_MAX; i++) {
+		r=adc_pending[i];
+		if ((r != NULL) && !ADC_Request_Valid(r)) {
+			adc_pending[i]=NULL;
+			g_adc_stats.Rejects++;
+			continue;
+		}
+		if ((r != NULL) && (left > r->Conv[r->Next].Profile->Window)
+			&& ((best < 0) || ((int32_t)(r->Due - adc_pending[best]->Due) < 0)))
+			best=i;
+	}
+	if (best < 0)
+		return 0;
+	adc_cur=best;
+	r=adc_pending[best];
+	conv=&r->Conv[r->Next];
+	ADC_Apply_Profile(conv->Profile);
+	ADC_Update_MuxSel(conv->MuxSel);
+	ADC0->SC2&=~ADC_SC2_ADTRG_MASK;     // select software trigger
+	ADC0->SC1[0] = ADC_SC1_AIEN(1)|ADC_SC1_ADCH(conv->Channel & ADC_SC1_ADCH_MASK);
+	return 1;
+}
+
+// Sample of the conversion that just completed; completes its request when it is the last
+__STATIC_FORCEINLINE void ADC_Lopri_Done(uint16_t sample) {
+	ADC_Request_t * r=adc_pending[adc_cur];
+
+	if ((r == NULL) || (r->Next >= ADC_BATCH_MAX))
+		return;
+	r->Sample[r->Next++]=sample;
+	g_adc_stats.Conversions++;
+	if (r->Next < r->Count)
+		return;
+	adc_pending[adc_cur]=NULL;
+	if ((r->Deadline != 0) && ((int32_t)(osKernelGetSysTimerCount() - r->Due) > 0))
+		g_adc_stats.Misses++;
+	r->Done=1;
+	if (r->Thread != NULL)
+		osThreadFlagsSet(r->Thread, EV_ADC_DONE);
+}
+
 /***************************************
  * ADC0_IRQHandler:
  ****************************************/
 void ADC0_IRQHandler() {
 	volatile static uint8_t modeHBLED=1;
-	static ADC_Request_t req;
-	static ADC_Response_t res;
-	static volatile osStatus_t qstat = osOK;
-	volatile static uint16_t t1,t2;
-	int diff=0;
+	int depth;
 	DEBUG_START(DBG_ADC_ISR_POS);
 
+#if ENABLE_OVERCURRENT_TRIP
+	if (Overcurrent_Armed()) {            // only a compare conversion above the limit completes
+		Overcurrent_Trip();
+		DEBUG_STOP(DBG_ADC_ISR_POS);
+		return;
+	}
+#endif
 	if (modeHBLED) {
-		Control_HBLED();
-		t1=TPM0->CNT;
-		t2=TPM0->CNT;
-		diff=PWM_PERIOD-(int)t2;
-		if (t2 < t1) diff+=PWM_PERIOD;   // if cnt down, add a full PWM_PERIOD to counts left.
-		if (diff > TPM_WINDOW) {
-			qstat=osMessageQueueGet(ADC_RequestQueue,&req,NULL,0);
-			if (qstat == osOK) {                 // did we get one?
-				// Configure the low-priority conversion
+#if USE_ADC_OVERSAMPLING
+		ADC_Sense_Complete();
+#else
+		CONTROL_HBLED();
+#endif
+		depth=ADC_Fill_Pending();
+		if (depth) {
+			depth+=osMessageQueueGetCount(ADC_RequestQueue);
+			g_adc_stats.Depth=depth;
+			if (depth > g_adc_stats.Max_Depth)
+				g_adc_stats.Max_Depth=depth;
+			if (ADC_Start_Lopri()) {         // conversion fits before the next control conversion
 				modeHBLED=0;
-				ADC_Update_MuxSel(req.MuxSel);
-				ADC0->SC2&=~ADC_SC2_ADTRG_MASK;     // select software trigger
-				ADC0->SC1[0] = ADC_SC1_AIEN(1)|ADC_SC1_ADCH(req.Channel & ADC_SC1_ADCH_MASK);
+				g_adc_stats.Windows++;
 //				DEBUG_START(DBG_LOPRI_ADC_POS);
-			}  // else no pending request or unable to fetch request.		
+			} else {
+				g_adc_stats.Window_Misses++;   // requests waiting, none fits
+			}
+		} else {
+			g_adc_stats.Depth=0;
 		}
+#if ENABLE_OVERCURRENT_TRIP
+		if (modeHBLED)
+			Overcurrent_Arm();                 // watch the current until the next conversion
+#endif
 	} else {													// Else we must be here for a low-prio conversion.
-		res.Sample=ADC0->R[0];        // first read the value in case we trigger right away.
+		ADC_Lopri_Done(ADC0->R[0]);        // first read the value in case we trigger right away.
+		if (ADC_Start_Lopri()) {
+			DEBUG_STOP(DBG_ADC_ISR_POS);        // another conversion packed into the same window
+			return;
+		}
 		modeHBLED=1;
-#if USE_SYNC_NO_FREQ_DIV
-		// Re-enable TPMO overflow to trigger conversion 
+		ADC_Apply_Profile(&ADC_Sense_Profile);
+#if USE_SYNC_NO_FREQ_DIV || USE_SYNC_HW_CTL_FREQ_DIV
+		// Re-enable hardware trigger (TPM0 or control trigger timer overflow) to start conversion 
 		ADC0->SC2|=ADC_SC2_ADTRG(1);  // select hardware trigger
 		ADC_Update_MuxSel(ADC_SENSE_MUXSEL);
 		ADC0->SC1[0] = ADC_SC1_AIEN(1)|ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
 #else
 		// Let TPM IRQ handler start ADC conversion with software
+#if ENABLE_OVERCURRENT_TRIP
+		Overcurrent_Arm();
+#endif
 #endif
-		res.Channel=req.Channel;
-		res.MuxSel = req.MuxSel;
-		qstat=osMessageQueuePut(req.ResponseQueue,&res,NULL,0);
 //		DEBUG_STOP(DBG_LOPRI_ADC_POS);
 	}
 	DEBUG_STOP(DBG_ADC_ISR_POS);
@@ -77,64 +225,152 @@ void ADC0_IRQHandler() {
 #else // don't use ADC server
 void ADC0_IRQHandler() {
 	FPTB->PSOR = MASK(DBG_ADC_ISR_POS);
-	Control_HBLED();
+#if ENABLE_OVERCURRENT_TRIP
+	if (Overcurrent_Armed()) {
+		Overcurrent_Trip();
+		FPTB->PCOR = MASK(DBG_ADC_ISR_POS);
+		return;
+	}
+#endif
+#if USE_ADC_OVERSAMPLING
+	ADC_Sense_Complete();
+#else
+	CONTROL_HBLED();
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+	Overcurrent_Arm();
+#endif
 	FPTB->PCOR = MASK(DBG_ADC_ISR_POS);
 }
 #endif // don't use ADC server
 #endif // USE_ADC_INTERRUPT
 
 #if USE_ADC_SERVER
+/* Low-priority channel profiles. The touchscreen's resistive divider is a
+ * high-impedance source: long sample time, and 4 conversions averaged. 
+ * Results stay 16 bit for the touchscreen calibration. */
+static const ADC_PROFILE_T ADC_Profiles[] = {
+	ADC_PROFILE(LCD_TS_YD_ADC_CHAN, LCD_TS_YD_ADC_MUXSEL, 3, 1, 1, 4),
+	ADC_PROFILE(LCD_TS_XR_ADC_CHAN, LCD_TS_XR_ADC_MUXSEL, 3, 1, 1, 4),
+};
+static const ADC_PROFILE_T ADC_Default_Profile = ADC_PROFILE(0, 0, 3, -1, 1, 1);
+
+static const ADC_PROFILE_T * ADC_Find_Profile(uint8_t channel, uint8_t muxsel) {
+	int i;
+
+	for (i = 0; i < sizeof(ADC_Profiles)/sizeof(ADC_Profiles[0]); i++) {
+		if ((ADC_Profiles[i].Channel == channel) && (ADC_Profiles[i].MuxSel == muxsel))
+			return &ADC_Profiles[i];
+	}
+	return &ADC_Default_Profile;
+}
+
 /***************************************
- * request_conversion:
+ * ADC_Submit:
  *
- * Request a low-priority conversion.
- *
-* mostly just abstracts the conversion
- * request process into the ADC server code.
+ * Queue the caller's request (Count and Conv[]
+ * channel/mux select filled in) and return.
+ * The ADC ISR writes the samples into it.
  * 
  ****************************************/
-uint16_t request_conversion(uint8_t channel, uint8_t muxsel) {
-	static ADC_Request_t req;
-	ADC_Response_t  res;
+int ADC_Submit(ADC_Request_t * req) {
 	osStatus_t qstat;
+	int i;
 
-	DEBUG_START(DBG_LOPRI_ADC_POS);
-	req.Channel=channel;
-	req.MuxSel = muxsel;
-	req.ResponseQueue=ADC_ResponseQueue;
+	if ((req->Count < 1) || (req->Count > ADC_BATCH_MAX))
+		return 0;
+	for (i = 0; i < req->Count; i++)
+		req->Conv[i].Profile = ADC_Find_Profile(req->Conv[i].Channel, req->Conv[i].MuxSel);
+	req->Next = 0;
+	req->Done = 0;
+	req->Thread = osThreadGetId();
+	req->Start = osKernelGetSysTimerCount();
+	req->Due = req->Start + (req->Deadline? req->Deadline : ADC_DEADLINE_NONE);
 	qstat=osErrorResource;
 	while (qstat == osErrorResource) // Keep trying if the queue is full
 		qstat = osMessageQueuePut(ADC_RequestQueue,&req, 0, osWaitForever);
-	if (qstat != osOK) {             // Did we error out for another reason.
-		DEBUG_STOP(DBG_LOPRI_ADC_POS);
-		return(0);      // return something even if we failed to enqueue
+	return (qstat == osOK);          // else we errored out for another reason.
+}
+
+/***************************************
+ * ADC_Wait:
+ *
+ * Wait until a submitted request is done. The
+ * flag is per thread, so a thread may have
+ * several requests outstanding.
+ * 
+ ****************************************/
+int ADC_Wait(ADC_Request_t * req, uint32_t timeout) {
+	uint32_t lat;
+
+	while (!req->Done) {
+		if (osThreadFlagsWait(EV_ADC_DONE, osFlagsWaitAny, timeout) & osFlagsError)
+			return 0;
 	}
+	lat = osKernelGetSysTimerCount() - req->Start;
+	g_adc_stats.Requests++;
+	g_adc_stats.Latency = lat;
+	if (lat > g_adc_stats.Max_Latency)
+		g_adc_stats.Max_Latency = lat;
+	return 1;
+}
 
-	// enqueue the response.
-	qstat=osMessageQueueGet(ADC_ResponseQueue,&res,NULL,osWaitForever);
+/***************************************
+ * request_conversions:
+ *
+ * Request a batch of n low-priority conversions
+ * (channel and mux select in conv[]) and wait
+ * for all n samples.
+ * 
+ ****************************************/
+int request_conversions(ADC_Conv_t * conv, int n, uint16_t * sample) {
+	ADC_Request_t req;
+	int i;
+
+	if ((n < 1) || (n > ADC_BATCH_MAX))
+		return 0;
+	DEBUG_START(DBG_LOPRI_ADC_POS);
+	req.Count = n;
+	req.Deadline = 0;
+	for (i = 0; i < n; i++)
+		req.Conv[i] = conv[i];
+	if (!ADC_Submit(&req) || !ADC_Wait(&req, osWaitForever)) {
+		DEBUG_STOP(DBG_LOPRI_ADC_POS);
+		return 0;
+	}
+	for (i = 0; i < n; i++)
+		sample[i] = req.Sample[i];
 	DEBUG_STOP(DBG_LOPRI_ADC_POS);
-	return(res.Sample);
+	return n;
+}
+
+/***************************************
+ * request_conversion:
+ *
+ * Request a low-priority conversion.
+ *
+* mostly just abstracts the conversion
+ * request process into the ADC server code.
+ * 
+ ****************************************/
+uint16_t request_conversion(uint8_t channel, uint8_t muxsel) {
+	ADC_Conv_t conv;
+	uint16_t sample = 0;      // return something even if we failed to enqueue
+
+	conv.Channel = channel;
+	conv.MuxSel = muxsel;
+	request_conversions(&conv, 1, &sample);
+	return(sample);
 }
 
 void Init_ADC(void) {
 
-	ADC_RequestQueue=osMessageQueueNew(4,sizeof(ADC_Request_t),NULL);
-	ADC_ResponseQueue=osMessageQueueNew(4,sizeof(ADC_Response_t),NULL);
+	ADC_RequestQueue=osMessageQueueNew(ADC_QUEUE_LEN,sizeof(ADC_Request_t *),NULL);
 
 	// Configure ADC to read Ch 8 (FPTB 0)
 	SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK; 
-	ADC0->CFG1 = 0x0D; // 0000 1101
-	// 0 Normal power
-	// 00 ADIV clock divide ratio 1
-	// 0  ADLSMP short sample time
-	// 11 MODE 16 bit 
-	// 01 ADICLK Bus clock/2
-
-	ADC0->CFG2 = 4; // 0000 0100 
-	// 0 MUXSEL ADxxa channels selected
-	// 0 ADACKEN Don't use asynch clock output
-	// 1 ADHSC Use high-speed configuration
-	// 00 ADLSTS (not used)
+	ADC_Apply_Profile(&ADC_Sense_Profile); // CFG1, CFG2 and SC3 for the HBLED conversions
+	// Normal power, ADCK bus clock/2, short sample, 16 bit, high-speed configuration
 
 	ADC0->SC2 = ADC_SC2_REFSEL(0);
 
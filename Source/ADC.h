@@ -1,31 +1,122 @@
 #ifndef ADC_H
 #define ADC_H
+#include <MKL25Z4.h>
 #include <cmsis_os2.h>
 #include "config.h"
+#include "control.h"
 
 /* Cannot start a low-priority conversion within the time required
- * for conversion + dequeue req + enqueue response + ISR latency.
+ * for conversion + completion + ISR latency.
  * measured TPM count for this at 0x1DB TPM counts, and add some headroom.
  * This should ensure that the conversion completes and results retrieved
  * BEFORE the HBLED conversion starts.
+ * This is for a single short-sample 16-bit conversion; a channel profile
+ * that converts for longer adds the difference (ADC_PROFILE_T Window).
  */
 #define TPM_WINDOW  100 //
 
+/* Per-channel conversion profile: resolution, sample time, high-speed
+ * configuration and hardware averaging, kept as the CFG1, CFG2 (without
+ * MUXSEL) and SC3 values that select them. The ADC server writes a
+ * request's profile before its conversion and the current-sense profile
+ * (ADC_Sense_Profile, control.c) after it.
+ *   ADC_PROFILE(channel, muxsel, mode, lsts, hsc, avg)
+ *   mode: CFG1 MODE, 0 8-bit, 1 12-bit, 2 10-bit, 3 16-bit
+ *   lsts: -1 short sample, 0-3 long sample with 20, 12, 6 or 2 extra ADCK
+ *   hsc:  1 high-speed configuration (2 extra ADCK)
+ *   avg:  1 (off), 4, 8, 16 or 32 conversions averaged
+ * ADCK is bus/2 = 12 MHz, 4 TPM counts. */
 typedef struct {
 	uint8_t Channel, MuxSel;
-	osMessageQueueId_t ResponseQueue;
-} ADC_Request_t;
+	uint8_t CFG1, CFG2, SC3;
+	uint16_t Window;	// TPM counts needed before the next control conversion
+} ADC_PROFILE_T;
+
+#define ADC_BCT(mode) (((mode) == 3)? 25 : ((mode) == 0)? 17 : 20) // base conversion, ADCK
+#define ADC_LST(lsts) (((lsts) < 0)? 0 : ((lsts) == 0)? 20 : ((lsts) == 1)? 12 : ((lsts) == 2)? 6 : 2)
+#define ADC_PROFILE_ADCK(mode, lsts, hsc, avg) (5 + (avg)*(ADC_BCT(mode) + ADC_LST(lsts) + ((hsc)? 2 : 0)))
+#define ADC_AVGS(avg) (((avg) == 4)? 0 : ((avg) == 8)? 1 : ((avg) == 16)? 2 : 3)
+
+#define ADC_PROFILE(channel, muxsel, mode, lsts, hsc, avg) { \
+	(channel), (muxsel), \
+	ADC_CFG1_ADICLK(1) | ADC_CFG1_MODE(mode) | (((lsts) >= 0)? ADC_CFG1_ADLSMP_MASK : 0), \
+	(((hsc)? ADC_CFG2_ADHSC_MASK : 0) | ADC_CFG2_ADLSTS(((lsts) >= 0)? (lsts) : 0)), \
+	(((avg) > 1)? (ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(ADC_AVGS(avg))) : 0), \
+	TPM_WINDOW + 4*(ADC_PROFILE_ADCK(mode, lsts, hsc, avg) - ADC_PROFILE_ADCK(3, -1, 1, 1)) }
+
+extern const ADC_PROFILE_T ADC_Sense_Profile;
+
+// Write a profile's configuration; keeps MUXSEL and the calibration
+__STATIC_FORCEINLINE void ADC_Apply_Profile(const ADC_PROFILE_T * p) {
+	ADC0->CFG1 = p->CFG1;
+	ADC0->CFG2 = (ADC0->CFG2 & ADC_CFG2_MUXSEL_MASK) | p->CFG2;
+	ADC0->SC3 = p->SC3;
+}
+
+/* Batched low-priority conversions. A request carries up to ADC_BATCH_MAX
+ * channel/mux pairs and costs one queue round trip. The server starts its
+ * conversions in order, chaining the next one from the completion interrupt
+ * while it still fits before the next control conversion, and otherwise in
+ * the following idle windows, and completes the request when all the
+ * samples are in. A single conversion is a batch of one (request_conversion).
+ *
+ * The client owns the request, which must stay valid until it completes.
+ * ADC_Submit queues a pointer to it; the ADC ISR writes the samples straight
+ * into it, sets Done and sets EV_ADC_DONE on the submitting thread. Between
+ * ADC_Submit and ADC_Wait the client can do other work. request_conversions
+ * is ADC_Submit followed by ADC_Wait.
+ *
+ * Scheduling: the ISR keeps up to ADC_PENDING_MAX dequeued requests. In each
+ * window it starts, of the pending conversions whose profile Window fits in
+ * the time left before the next control conversion, the one whose request
+ * is due first, and packs further ones into the same window from the
+ * completion interrupt. A request's Deadline is relative to ADC_Submit;
+ * without one it is due after ADC_DEADLINE_NONE, so it still ages ahead of
+ * later requests. A conversion that does not fit is never started, so
+ * control conversions are never delayed. */
+#define ADC_BATCH_MAX (4)
+#define ADC_PENDING_MAX (4)
+#define ADC_QUEUE_LEN (4)	// ADC_RequestQueue entries
+#define EV_ADC_DONE (1U << 15)	// thread flag
+#define ADC_DEADLINE_US(us) ((us)*48)	// kernel timer counts, 48 MHz core clock
+#define ADC_DEADLINE_NONE (ADC_DEADLINE_US(100000))
 
 typedef struct {
 	uint8_t Channel, MuxSel;
-	uint16_t Sample;
-} ADC_Response_t;
+	const ADC_PROFILE_T * Profile;	// filled in by ADC_Submit
+} ADC_Conv_t;
+
+typedef struct {
+	uint8_t Count;	// conversions, 1 to ADC_BATCH_MAX
+	ADC_Conv_t Conv[ADC_BATCH_MAX];
+	uint32_t Deadline;		// kernel timer counts after ADC_Submit, 0 if none
+	volatile uint16_t Sample[ADC_BATCH_MAX];	// written by the ADC ISR
+	volatile uint8_t Done;
+	uint8_t Next;					// next conversion, ISR
+	osThreadId_t Thread;	// signalled on completion, set by ADC_Submit
+	uint32_t Start, Due;	// kernel timer counts, set by ADC_Submit
+} ADC_Request_t;
+
+typedef struct {
+	uint32_t Requests, Conversions;
+	uint32_t Windows;			// idle windows in which low-priority conversions ran
+	uint32_t Window_Misses;	// windows with requests waiting but none fitting
+	uint32_t Misses;			// requests completed after their deadline
+	uint32_t Rejects;			// malformed requests dropped (not from ADC_Submit)
+	uint32_t Depth, Max_Depth;	// requests pending and queued, at the last control update
+	uint32_t Latency, Max_Latency;	// submit to wakeup, kernel timer counts
+} ADC_STATS_T;
+
+extern volatile ADC_STATS_T g_adc_stats;
 
-extern osMessageQueueId_t ADC_RequestQueue;
-extern osMessageQueueId_t ADC_ResultQueue;
+extern osMessageQueueId_t ADC_RequestQueue;	// of ADC_Request_t *
 
 void Init_ADC(void);
+int ADC_Calibrate(void);	// 1 if calibration passed; leaves the ADC idle
 uint16_t request_conversion(uint8_t channel, uint8_t muxsel);    // handles enqueuing the req and waiting for the response.
+int request_conversions(ADC_Conv_t * conv, int n, uint16_t * sample); // batch of n; returns n, or 0 on error
+int ADC_Submit(ADC_Request_t * req);	// fill in Count, Conv[] and Deadline first; 1 if queued
+int ADC_Wait(ADC_Request_t * req, uint32_t timeout); // 1 when req is done, 0 on timeout
 void ADC_Update_MuxSel(uint32_t);
 
 #endif
@@ -71,6 +71,59 @@ void Start_DMA_Playback() {
 	TPM0_Start();
 }
 
+/* Setpoint playback (setpoint_dma.h): channel ch writes 16-bit DAC codes,
+ * one per periodic trigger from PIT channel ch, and after each transfer
+ * links to channel link_ch, which writes the next 32-bit PIT load value.
+ * Interrupt when ch's byte count reaches zero. */
+void Configure_DMA_For_Setpoint(uint32_t ch, uint32_t link_ch) {
+	
+	// Disable DMA channels in order to allow changes
+	DMAMUX0->CHCFG[ch] = 0;
+	DMAMUX0->CHCFG[link_ch] = 0;
+
+	// Increment source, transfer words (16 bits), one per request,
+	// stop requests when done, link to link_ch after each transfer
+	DMA0->DMA[ch].DCR = DMA_DCR_EINT_MASK | DMA_DCR_SINC_MASK | 
+											DMA_DCR_SSIZE(2) | DMA_DCR_DSIZE(2) |
+											DMA_DCR_CS_MASK | DMA_DCR_D_REQ_MASK |
+											DMA_DCR_LINKCC(2) | DMA_DCR_LCH1(link_ch);
+	DMA0->DMA[ch].DAR = DMA_DAR_DAR((uint32_t) (&(DAC0->DAT[0])));
+
+	// Increment source, transfer long words (32 bits), started by the link only
+	DMA0->DMA[link_ch].DCR = DMA_DCR_SINC_MASK | DMA_DCR_SSIZE(0) | DMA_DCR_DSIZE(0) |
+											DMA_DCR_CS_MASK;
+	DMA0->DMA[link_ch].DAR = DMA_DAR_DAR((uint32_t) (&(PIT->CHANNEL[ch].LDVAL)));
+
+	// Same priority as the ADC ISR, which reads the channel's byte count
+	NVIC_SetPriority((IRQn_Type) (DMA0_IRQn + ch), 2); 
+	NVIC_ClearPendingIRQ((IRQn_Type) (DMA0_IRQn + ch)); 
+	NVIC_EnableIRQ((IRQn_Type) (DMA0_IRQn + ch));	
+}
+
+void Start_DMA_Setpoint(uint32_t ch, uint32_t link_ch, uint16_t * codes, uint32_t * ldvals, uint32_t count) {
+
+	// initialize source pointers
+	DMA0->DMA[ch].SAR = DMA_SAR_SAR((uint32_t) codes);
+	DMA0->DMA[link_ch].SAR = DMA_SAR_SAR((uint32_t) ldvals);
+
+	// clear done flags, then byte counts
+	DMA0->DMA[ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK; 
+	DMA0->DMA[link_ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK; 
+	DMA0->DMA[ch].DSR_BCR = DMA_DSR_BCR_BCR(count*2);
+	DMA0->DMA[link_ch].DSR_BCR = DMA_DSR_BCR_BCR(count*4);
+
+	// Enable requests; D_REQ cleared ERQ at the end of the last playback
+	DMA0->DMA[ch].DCR |= DMA_DCR_ERQ_MASK;
+
+	// Always-enabled source, gated by PIT channel ch
+	DMAMUX0->CHCFG[ch] = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_TRIG_MASK | DMAMUX_CHCFG_SOURCE(60);
+}
+
+void Stop_DMA_Setpoint(uint32_t ch) {
+	DMAMUX0->CHCFG[ch] = 0;
+	DMA0->DMA[ch].DCR &= ~DMA_DCR_ERQ_MASK;
+}
+
 void DMA0_IRQHandler(void) {
 	// Set debug signal
 	DEBUG_START(DBG_DMA_ISR_POS);
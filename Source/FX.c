@@ -1,5 +1,9 @@
 #include "FX.h"
 
+#if FX_COUNT_OVERFLOW
+volatile uint32_t g_fx_overflow_count = 0; // saturation events in inline FX operations
+#endif
+
 FX16_16 Multiply_FX(FX16_16 a, FX16_16 b) {
 	int64_t p, pa, pb;
 	// Long multiply first. 
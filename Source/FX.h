@@ -1,17 +1,114 @@
 #ifndef FX_H
 #define FX_H
 #include <stdint.h>
+#include "config.h"
 
-typedef int32_t FX16_16;
+typedef int32_t FX16_16;	// Q16.16: general control path, duty and mA values
+typedef int16_t FX1_15;		// Q1.15: normalized values in [-1, 1), e.g. interpolation weights
 
 #define FL_TO_FX(x)	((FX16_16)((x)*65536.0))
 #define INT_TO_FX(x) ((FX16_16)((x)*65536))
 #define FX_TO_INT(x) ((int32_t)((x)/65536))
 #define FX_TO_FL(x) ((float)((x)/65536.0))
 
+#define FL_TO_FX1_15(x)	((FX1_15)((x)*32768.0))
+#define FX1_15_MAX (INT16_MAX)
+#define FX1_15_MIN (INT16_MIN)
+
+// Out-of-line Q16.16 operations. No overflow handling.
 FX16_16 Multiply_FX(FX16_16 a, FX16_16 b);
 FX16_16 Add_FX(FX16_16 a, FX16_16 b);
 FX16_16 Subtract_FX(FX16_16 a, FX16_16 b);
 
+//=============================================================
+// Inline saturating operations
+// These inline into the control ISR. On overflow the result clamps to the
+// most positive or negative value instead of wrapping around.
+// With FX_COUNT_OVERFLOW set in config.h each saturation event also
+// increments g_fx_overflow_count.
+//=============================================================
+#if FX_COUNT_OVERFLOW
+extern volatile uint32_t g_fx_overflow_count;
+#define FX_OVERFLOW() (g_fx_overflow_count++)
+#else
+#define FX_OVERFLOW()
+#endif
+
+// Add with saturation. Overflow iff both operands have the same sign and the
+// sum's sign differs.
+static inline int32_t FX_Add_Sat32(int32_t a, int32_t b) {
+	int32_t s = (int32_t)((uint32_t)a + (uint32_t)b);
+	if (((a ^ s) & (b ^ s)) < 0) {
+		FX_OVERFLOW();
+		s = (a < 0)? INT32_MIN : INT32_MAX;
+	}
+	return s;
+}
+
+static inline int32_t FX_Subtract_Sat32(int32_t a, int32_t b) {
+	int32_t s = (int32_t)((uint32_t)a - (uint32_t)b);
+	if (((a ^ b) & (a ^ s)) < 0) {
+		FX_OVERFLOW();
+		s = (a < 0)? INT32_MIN : INT32_MAX;
+	}
+	return s;
+}
+
+static inline int32_t FX_Clamp64(int64_t p) {
+	if (p > INT32_MAX) {
+		FX_OVERFLOW();
+		return INT32_MAX;
+	} else if (p < INT32_MIN) {
+		FX_OVERFLOW();
+		return INT32_MIN;
+	}
+	return (int32_t) p;
+}
+
+// Q16.16
+static inline FX16_16 Add_Sat_FX(FX16_16 a, FX16_16 b) {
+	return FX_Add_Sat32(a, b);
+}
+
+static inline FX16_16 Subtract_Sat_FX(FX16_16 a, FX16_16 b) {
+	return FX_Subtract_Sat32(a, b);
+}
+
+static inline FX16_16 Multiply_Sat_FX(FX16_16 a, FX16_16 b) {
+	return FX_Clamp64(((int64_t) a * b) >> 16);
+}
+
+// Q1.15: 32-bit intermediates only, so no 64-bit multiply on the M0+
+static inline FX1_15 FX1_15_Clamp32(int32_t s) {
+	if (s > FX1_15_MAX) {
+		FX_OVERFLOW();
+		return FX1_15_MAX;
+	} else if (s < FX1_15_MIN) {
+		FX_OVERFLOW();
+		return FX1_15_MIN;
+	}
+	return (FX1_15) s;
+}
+
+static inline FX1_15 Add_Sat_FX1_15(FX1_15 a, FX1_15 b) {
+	return FX1_15_Clamp32((int32_t) a + b);
+}
+
+static inline FX1_15 Subtract_Sat_FX1_15(FX1_15 a, FX1_15 b) {
+	return FX1_15_Clamp32((int32_t) a - b);
+}
+
+static inline FX1_15 Multiply_Sat_FX1_15(FX1_15 a, FX1_15 b) {
+	return FX1_15_Clamp32(((int32_t) a * b) >> 15); // only -1 * -1 overflows
+}
+
+// Q1.15 weight times Q16.16 value, giving Q16.16 (e.g. table interpolation).
+// x splits into a signed high and an unsigned low half, so both products fit
+// in 32 bits and w*x >> 15 = 2*w*hi + (w*lo >> 15) exactly. No overflow
+// handling: the result must fit in Q16.16, as it does for |w| <= 1.
+static inline FX16_16 Multiply_FX1_15_FX(FX1_15 w, FX16_16 x) {
+	int32_t hi = x >> 16, lo = x & 0xFFFF;
+	return (FX16_16)((uint32_t)(w*hi) << 1) + ((w*lo) >> 15);
+}
 
 #endif // FX_H
@@ -1,6 +1,7 @@
 #include <MKL25Z4.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "MMA8451.h"
 #include "I2C.h"
@@ -18,11 +19,8 @@
 #define SHOW_DATA 0
 #define MAX_ERROR 1
 
-#define M_PI_2 (M_PI/2.0f)
-#define M_PI_4 (M_PI/4.0f)
-
 int16_t acc_X=0, acc_Y=0, acc_Z=0;
-float roll=0.0, pitch=0.0;
+int roll = 0, pitch = 0; // degrees
 
 
 #if MMA_USE_INTERRUPTS
@@ -179,102 +177,90 @@ int init_mma()
 	return 1;
 }
 
-float approx_sqrtf(float z) { // from Wikipedia
-	int val_int = *(int*)&z; /* Same bits, but as an int */
-	const int a = 0x4c000;
+// Integer square root, rounded down: shifts, adds and compares only
+static uint32_t isqrt32(uint32_t x) {
+	uint32_t r = 0, b = 1UL << 30;
 
-  val_int -= 1 << 23; /* Subtract 2^m. */
-  val_int >>= 1; /* Divide by 2. */
-  val_int += 1 << 29; /* Add ((b + 1) / 2) * 2^m. */
-	val_int += a;
-	//	val_int = (1 << 29) + (val_int >> 1) - (1 << 22) + a;
-	return *(float*)&val_int; /* Interpret again as float */
+	while (b > x)
+		b >>= 2;
+	while (b != 0) {
+		if (x >= r + b) {
+			x -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+		b >>= 2;
+	}
+	return r;
 }
 
-float approx_atan2f(float y, float x) {
-	float a, abs_a, approx, adj=0.0;
-	char negate = 0;
-	
-	if (x == 0) { // special cases
-		if (y == 0.0)
-			return 0.0; // undefined, but return 0 by convention
-		else if (y < 0.0)
-			return -M_PI_2;
-		else
-			return M_PI_2;
-	}	else {
-		a = y/x;
-		if (a>1) {
-			a = x/y;
-			adj = M_PI_2;
-			negate = 1;
-		} else if (a<-1) {
-			a = x/y;
-			adj = -M_PI_2;
-			negate = 1;
-		}
-		abs_a = (a < 0)? -a : a;
-		approx = M_PI_4*a - a*(abs_a - 1)*(0.2447+0.0663*abs_a);
-		if (negate) {
-			approx = adj - approx;
-		}
-		
-		if (x > 0)
-			return approx;
-		else if (y >= 0)
-			return approx + M_PI;
-		else
-			return approx - M_PI;
-	}		
+/* atan2(y, x) in 1/ATAN_DEG_ONE degrees, (-180, 180]. One integer divide for
+ * a = min/max of |x|, |y| in Q15, then
+ *   atan(a) = 45a + a(1 - a)(14.02 + 3.80a) degrees, 0 <= a <= 1
+ * which is within 0.1 degree. Inputs up to 2^16 in magnitude. */
+#define ATAN_DEG_ONE (256)
+static int32_t atan2_deg(int32_t y, int32_t x) {
+	uint32_t ax = (x < 0)? -x : x, ay = (y < 0)? -y : y, a;
+	int32_t r;
+
+	if ((ax == 0) && (ay == 0))
+		return 0; // undefined, but 0 by convention
+	a = (ay <= ax)? (ay << 15)/ax : (ax << 15)/ay;
+	r = (45*ATAN_DEG_ONE*a) >> 15;
+	r += (((a*((1 << 15) - a)) >> 15)*((1402*ATAN_DEG_ONE)/100 + ((380*ATAN_DEG_ONE/100)*a >> 15))) >> 15;
+	if (ay > ax)
+		r = 90*ATAN_DEG_ONE - r;
+	if (x < 0)
+		r = 180*ATAN_DEG_ONE - r;
+	return (y < 0)? -r : r;
 }
 
 void convert_xyz_to_roll_pitch(void) {
-	float ax = acc_X/COUNTS_PER_G,
-				ay = acc_Y/COUNTS_PER_G,
-				az = acc_Z/COUNTS_PER_G;
+	int32_t ax = acc_X, ay = acc_Y, az = acc_Z; // counts: the scale cancels in atan2
 #if VALIDATE
-	float roll_ref, pitch_ref;
+	float fx = acc_X/(float) COUNTS_PER_G, fy = acc_Y/(float) COUNTS_PER_G, fz = acc_Z/(float) COUNTS_PER_G;
+	int roll_ref, pitch_ref;
 #endif
 	// See NXP/Freescale App Note AN3461 for explanations
 #if UP_AXIS_Z // original code - horizontal mode
 	#if 0	// select equation for roll
-	roll = atan2(ay, az)*180/M_PI; 	// Eqn. 25
+	roll = atan2_deg(ay, az)/ATAN_DEG_ONE; 	// Eqn. 25
   #else
-	roll = atan2(ay, SIGN(az)*(sqrt(az*az + MU*ax*ax)))*180/M_PI; 	// Eqn. 38
+	roll = atan2_deg(ay, SIGN(az)*(int32_t) isqrt32(az*az + (ax*ax)/MU_INV))/ATAN_DEG_ONE; 	// Eqn. 38
   #endif	
-	pitch = atan2(ax, sqrt(ay*ay + az*az))*180/M_PI; // Eqn. 26
+	pitch = atan2_deg(ax, isqrt32((uint32_t) (ay*ay) + (uint32_t) (az*az)))/ATAN_DEG_ONE; // Eqn. 26
 #endif
 	
 #if UP_AXIS_X 
 	// vertical board: X axis (instead of Z) points up 
-	roll = atan2(ay, ax)*180/M_PI;
-	pitch = atan2(az, sqrt(ay*ay + ax*ax))*180/M_PI; // Eqn. 26
+	roll = atan2_deg(ay, ax)/ATAN_DEG_ONE;
+	pitch = atan2_deg(az, isqrt32((uint32_t) (ay*ay) + (uint32_t) (ax*ax)))/ATAN_DEG_ONE; // Eqn. 26
 #endif	
 
 #if VALIDATE
-	if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) { 
-		roll_ref = atan2f(ay, az)*(180/M_PI);
-		pitch_ref = atan2f(ax, sqrt(ay*ay + az*az))*(180/M_PI);
-		if (fabs(roll-roll_ref) > MAX_ERROR) {
-			printf("Roll Error: %f, should be %f.\n\r ay=%f, az=%f\n\r", roll, roll_ref, ay, az);
+	if (!((fx == 0.0f) && (fy == 0.0f) && (fz == 0.0f))) { 
+		roll_ref = atan2f(fy, fz)*(180/M_PI);
+		pitch_ref = atan2f(fx, sqrt(fy*fy + fz*fz))*(180/M_PI);
+		if (abs(roll-roll_ref) > MAX_ERROR) {
+			printf("Roll Error: %d, should be %d.\n\r ay=%f, az=%f\n\r", roll, roll_ref, fy, fz);
 		}
-		if (fabs(pitch-pitch_ref) > MAX_ERROR) {
-			printf("Pitch Error: %f, should be %f.\n\r ax=%f, ay=%f, az=%f\n\r", pitch, pitch_ref, ax, ay, az);
+		if (abs(pitch-pitch_ref) > MAX_ERROR) {
+			printf("Pitch Error: %d, should be %d.\n\r ax=%f, ay=%f, az=%f\n\r", pitch, pitch_ref, fx, fy, fz);
 		}
 	}
 #endif
 	
 #if SHOW_DATA
-	printf("Roll: %f \tPitch: %f\n\r", roll, pitch);
+	printf("Roll: %d \tPitch: %d\n\r", roll, pitch);
 #endif
 }
 
-float Acc_Get_Magnitude(void) {
-	float x, y, z;
-	x = acc_X/COUNTS_PER_G;
-	y = acc_Y/COUNTS_PER_G;
-	z = acc_Z/COUNTS_PER_G;
-	return(sqrt(x*x + y*y + z*z));
+// mg
+int Acc_Get_Magnitude(void) {
+	int32_t x = acc_X, y = acc_Y, z = acc_Z;
+
+	return (isqrt32((uint32_t) (x*x) + (uint32_t) (y*y) + (uint32_t) (z*z))*1000)/COUNTS_PER_G;
 }
 
 
@@ -12,6 +12,19 @@
 #include "FX.h"
 #include "debug.h"
 #include "timers.h"
+#include "waveform.h"
+#if USE_DUTY_FEEDFORWARD
+#include "feedforward.h"
+#endif
+#if USE_AUTOTUNE
+#include "autotune.h"
+#endif
+#if USE_SETPOINT_SHAPING
+#include "setpoint_shape.h"
+#if USE_AUTOTUNE && USE_ADC_SAMPLE_PHASE
+#error "UI row 14 has room for two of the Ph, Tune and Rise fields"
+#endif
+#endif
 
 volatile int g_scope_height = INIT_SCOPE_HEIGHT;
 volatile int g_holdoff = PRE_TRIG_SAMPLES;
@@ -22,18 +35,53 @@ volatile int g_holdoff = PRE_TRIG_SAMPLES;
 UI_FIELD_T Fields[] = {
 	{"Duty Cycle  ", "ct", "", (volatile int *)&g_duty_cycle, NULL, {0,7}, 
 	&green, &black, 1, 0, 1, 1,Control_DutyCycle_Handler},
-	{"Enable Ctlr ", "", "", (volatile int *)&g_enable_control, NULL, {0,8}, 
+	// Row 8: controller on/off and feedforward sweep time, half-width fields
+	{"Ctlr ", "", "", (volatile int *)&g_enable_control, NULL, {0,8}, 
 	&green, &black, 1, 0, 0, 0, Control_OnOff_Handler},	
-	{"T_flash_prd ", "ms", "", (volatile int *)&g_flash_period, NULL, {0,9}, 
+#if USE_DUTY_FEEDFORWARD
+	{"FFms ", "", "", (volatile int *)&g_ff_learn_ms, NULL, {10,8}, 
+	&orange, &black, 1, 0, 1, 0, NULL},
+#endif
+	// Row 9: flash period and on time, half-width fields at columns 0 and 10
+	{"Prd ", "ms", "", (volatile int *)&g_flash_period, NULL, {0,9}, 
 	&orange, &black, 1, 0, 1, 1, NULL}, // Control_IntNonNegative_Handler},		
-	{"T_flash_on  ", "ms", "", (volatile int *)&g_flash_duration, NULL, {0,10}, 
+	{"On  ", "ms", "", (volatile int *)&g_flash_duration, NULL, {10,9}, 
 	&green, &black,  1, 0, 1, 1, Control_IntNonNegative_Handler},
+	// Row 10: setpoint waveform (waveform.h): shape, and trapezoid edge in %
+	{"Wave ", "", "", (volatile int *)&g_wave_shape, NULL, {0,10}, 
+	&green, &black, 1, 0, 0, 1, Wave_Shape_Handler},
+	{"Edge ", "%", "", (volatile int *)&g_wave_edge_pct, NULL, {10,10}, 
+	&green, &black, 1, 0, 0, 1, Wave_Edge_Handler},
 	{"I_set       ", "mA", "", (volatile int *)&g_set_current_mA, NULL, {0,11}, 
 	&green, &black, 1, 0, 1, 1, Control_IntNonNegative_Handler},
 	{"I_set_peak  ", "mA", "", (volatile int *)&g_peak_set_current_mA, NULL, {0,12}, 
 	&green, &black, 1, 0, 0, 0, Control_IntNonNegative_Handler},
 	{"I_measured  ", "mA", "", (volatile int *)&g_measured_current_mA, NULL, {0,13}, 
 	&orange, &black, 1, 0, 1, 1, NULL},
+	// Row 14: half-width fields, columns 0 and 10
+#if USE_ADC_SAMPLE_PHASE
+	// ADC sampling phase, 48 MHz counts after the TPM0 overflow
+	{"Ph ", "", "", (volatile int *)&g_adc_sample_phase, NULL, {0,14}, 
+	&green, &black, 1, 0, 0, 1, Control_Sample_Phase_Handler},
+#endif
+#if USE_AUTOTUNE
+#if USE_SETPOINT_SHAPING
+	{"Tune ", "", "", (volatile int *)&g_autotune_settle_us, NULL, {0,14}, // settling time, us (replaces Rise0)
+#else
+	{"Tune ", "", "", (volatile int *)&g_autotune_settle_us, NULL, {10,14}, // settling time, us
+#endif
+	&green, &black, 1, 0, 0, 1, Autotune_Handler},
+#endif
+#if USE_SETPOINT_SHAPING
+#if !USE_ADC_SAMPLE_PHASE && !USE_AUTOTUNE
+	// Rise time without shaping. Without room, select Shape_None with Rise to see it.
+	{"Rise0 ", "", "", (volatile int *)&g_shape_rise_us[Shape_None], NULL, {0,14}, 
+	&orange, &black, 1, 0, 1, 1, NULL},
+#endif
+	// Rise time with the selected profile
+	{"Rise ", "", "", (volatile int *)&g_shape_rise_now_us, NULL, {10,14}, 
+	&green, &black, 1, 0, 0, 1, Shape_Handler},
+#endif
 };
 
 UI_SLIDER_T Slider = {
@@ -165,7 +213,7 @@ int ave_samples(volatile uint16_t *buff) {
 void UI_Draw_Scope(int trig_sample) {
 	PT_T tp1,tp2;
 	int start_idx = 0;
-	int setY, measY, idx = 0;
+	int idx = 0;
 
 
 	// Clear the scope area.
@@ -179,14 +227,12 @@ void UI_Draw_Scope(int trig_sample) {
 		idx = (start_idx+x)%SAM_BUF_SIZE;	// active buffer position Shift by start_idx and wrap		
 		tp1.X = (x/SAMPLES_PER_PIXEL);				// displayX is sampleX/4
 		// plot set point
-		setY = SCALE_ADC_CODE_TO_SCOPE(ave_samples(&g_set_sample[idx]));
-		tp1.Y = SCALE_SCOPE(setY);		
+		tp1.Y = ADC_Code_To_Scope_Y(ave_samples(&g_set_sample[idx]), g_scope_height);
 		tp1.Y = CLIP_SCOPE(tp1.Y);
 		LCD_Plot_Pixel(&tp1,&blue);
 		
 		// plot measured data
-		measY = SCALE_ADC_CODE_TO_SCOPE(ave_samples(&g_meas_sample[idx]));
-		tp1.Y = SCALE_SCOPE(measY);		
+		tp1.Y = ADC_Code_To_Scope_Y(ave_samples(&g_meas_sample[idx]), g_scope_height);
 		tp1.Y = CLIP_SCOPE(tp1.Y);
 		LCD_Plot_Pixel(&tp1,&orange);
 	}
@@ -44,12 +44,8 @@ typedef struct  {
 
 extern volatile int g_scope_height;
 #define INIT_SCOPE_HEIGHT  (128)
-// #define CVT_RATIO ((0.75*V_REF_MV*MA_SCALING_FACTOR)/(ADC_FULL_SCALE*R_SENSE))
-#define CVT_RATIO ((0.125*V_REF_MV*MA_SCALING_FACTOR)/(ADC_FULL_SCALE*R_SENSE))
 #define DISP_SCALE (0xFFFF/g_scope_height)
-#define SCALE_SCOPE(val) (g_scope_height - ((g_scope_height*(val))/0x4000))
-
-#define SCALE_ADC_CODE_TO_SCOPE(sample) ((sample)*CVT_RATIO)
+// ADC code to scope row: ADC_Code_To_Scope_Y in units.h
 #define CLIP_SCOPE(val)   (val<0? 0 : (val > INIT_SCOPE_HEIGHT-1? INIT_SCOPE_HEIGHT-1: val))
 
 // Function prototypes
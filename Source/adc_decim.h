@@ -0,0 +1,74 @@
+#ifndef ADC_DECIM_H
+#define ADC_DECIM_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+#if USE_DITHERED_PWM
+#include "pwm_dither.h"
+#endif
+
+/* Current-sense oversampling and decimation (USE_ADC_OVERSAMPLING and
+ * ADC_HW_AVG_SAMPLES in control.h).
+ *
+ * Hardware averaging: with ADC_HW_AVG_SAMPLES > 1 the ADC performs that many
+ * back-to-back conversions for each result and returns their mean (SC3 AVGE,
+ * AVGS). The samples are one conversion time apart, so they also span part
+ * of the ripple, and the conversion takes ADC_CONV_TIME_NS(ADC_HW_AVG_SAMPLES).
+ *
+ * Software decimation: TPM0_IRQHandler starts a conversion in every PWM
+ * period, not only every SW_CTL_FREQ_DIV_FACTOR-th. The ADC ISR sums the
+ * results and, on the ADC_DECIM_FACTOR-th, hands their mean to the control
+ * ISR in g_adc_decim_result. This is a boxcar (first-order CIC) decimator:
+ * the control rate stays the same and the white noise falls by
+ * sqrt(ADC_DECIM_FACTOR). The samples are at the same point of each PWM
+ * period, so the ripple does not enter the mean.
+ *
+ * Effective noise floor, as a fraction of the single-conversion noise:
+ *   1/sqrt(ADC_HW_AVG_SAMPLES*ADC_DECIM_FACTOR)
+ * e.g. with SW_CTL_FREQ_DIV_FACTOR 3: 0.58 (decimation only), 0.29 (and 4
+ * hardware samples), 0.20 (and 8).
+ */
+
+#define ADC_DECIM_FACTOR (SW_CTL_FREQ_DIV_FACTOR)
+// The M0+ has no divide instruction and no 32x32->64 multiply, so a constant
+// divisor still becomes a library call. The mean is sum*floor(2^16/FACTOR)
+// >> 16 instead: sum <= FACTOR*65535, so the product fits in 32 bits, and it
+// falls short by at most 65536 % ADC_DECIM_FACTOR (1 for a factor of 3),
+// which the remainder check adds back. Exact for every sum.
+#define ADC_DECIM_RECIP (65536UL/ADC_DECIM_FACTOR)
+
+extern volatile uint32_t g_adc_decim_sum;
+extern volatile int g_adc_decim_n;
+extern volatile uint16_t g_adc_decim_result;	// mean of the last ADC_DECIM_FACTOR results
+
+// Add one result. Returns 1 when g_adc_decim_result holds a new mean.
+__STATIC_FORCEINLINE int ADC_Decim_Add(uint16_t code) {
+	uint32_t sum = g_adc_decim_sum + code, q;
+	int n = g_adc_decim_n + 1;
+
+	if (n < ADC_DECIM_FACTOR) {
+		g_adc_decim_sum = sum;
+		g_adc_decim_n = n;
+		return 0;
+	}
+	q = (sum*ADC_DECIM_RECIP) >> 16;
+	while (sum - q*ADC_DECIM_FACTOR >= ADC_DECIM_FACTOR)
+		q++;
+	g_adc_decim_result = q;
+	g_adc_decim_sum = 0;
+	g_adc_decim_n = 0;
+	return 1;
+}
+
+// ADC ISR work for a completed current-sense conversion
+__STATIC_FORCEINLINE void ADC_Sense_Complete(void) {
+	if (ADC_Decim_Add(ADC0->R[0]))
+		CONTROL_HBLED();
+#if USE_DITHERED_PWM
+	else
+		PWM_Dither_Step(); // no control update in this period
+#endif
+}
+
+#endif // ADC_DECIM_H
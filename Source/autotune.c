@@ -0,0 +1,190 @@
+#include <MKL25Z4.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "control.h"
+#include "timers.h"
+#include "autotune.h"
+#include "nvm.h"
+#if USE_DUTY_FEEDFORWARD
+#include "feedforward.h"
+#endif
+
+volatile AT_STATE_E g_autotune_state = AT_Idle;
+volatile int g_autotune_settle_us = 0;
+volatile FX16_16 g_autotune_ku = 0;
+volatile int g_autotune_tu_us = 0;
+volatile int g_autotune_bias = 0;
+
+static int at_skip;				// discard the next capture: it may predate a mode change
+static int at_captures;		// relay captures analyzed
+static int at_good;				// relay captures accepted
+static int64_t at_ku_sum;	// FX16_16
+static int32_t at_tu16_sum;	// samples, scaled by 16
+
+void Autotune_Start(void) {
+	if (Autotune_Running())
+		return;
+#if USE_DUTY_FEEDFORWARD
+	if (g_ff_valid)
+		g_autotune_bias = FF_Duty(g_peak_set_current_mA);
+	else
+#endif
+	if (g_autotune_bias == 0)
+		g_autotune_bias = LIM_DUTY_CYCLE/2;
+	at_skip = 1;
+	at_captures = at_good = 0;
+	at_ku_sum = at_tu16_sum = 0;
+	g_autotune_settle_us = 0;
+	g_autotune_state = AT_Relay;
+	Control_Set_Mode(Autotune);
+}
+
+int Autotune_Running(void) {
+	return (g_autotune_state == AT_Relay) || (g_autotune_state == AT_Verify);
+}
+
+// Find the pulse in the capture: samples [*start, *end) with the setpoint on.
+// Returns the setpoint ADC code, or 0 if there is no complete pulse.
+static int AT_Find_Pulse(int * start, int * end) {
+	int i = 0, set;
+
+	while ((i < SAM_BUF_SIZE) && (g_set_sample[i] == 0))
+		i++;
+	if (i >= SAM_BUF_SIZE)
+		return 0;
+	*start = i;
+	set = g_set_sample[i];
+	while ((i < SAM_BUF_SIZE) && (g_set_sample[i] == set))
+		i++;
+	if (i >= SAM_BUF_SIZE)
+		return 0; // pulse longer than the capture, or setpoint changed mid-pulse
+	*end = i;
+	return set;
+}
+
+// Measure the relay oscillation over the second half of the pulse.
+// Returns 1 and accumulates Ku and Tu if the capture is usable.
+static int AT_Analyze_Relay(void) {
+	int start, end, set, i, m, min, max, first = -1, last = -1, n = 0;
+	int32_t sum = 0, a;
+
+	set = AT_Find_Pulse(&start, &end);
+	if (set == 0)
+		return 0;
+	start += (end - start)/2;
+	min = max = g_meas_sample[start];
+	for (i = start; i < end; i++) {
+		m = g_meas_sample[i];
+		sum += m;
+		if (m < min)
+			min = m;
+		if (m > max)
+			max = m;
+		if ((i > start) && (g_meas_sample[i-1] < set) && (m >= set)) { // upward crossing
+			if (first < 0)
+				first = i;
+			last = i;
+			n++;
+		}
+	}
+	// Need a few full cycles, centered on the setpoint (bias has converged)
+	if (n < AT_MIN_CROSSINGS)
+		return 0;
+	sum /= (end - start);
+	if ((sum - set > set/8) || (set - sum > set/8))
+		return 0;
+	a = (max - min)/2;
+	if (a <= 0)
+		return 0;
+
+	// Ku = 4h/(pi*a), a in mA = a*1500/65536. 4*65536*65536/1500/pi: h<<34/(4712*a)
+	at_ku_sum += ((int64_t) AT_RELAY_DUTY << 34)/((int64_t) 4712*a);
+	at_tu16_sum += (16*(last - first))/(n - 1);
+	return 1;
+}
+
+static FX16_16 AT_Clamp(FX16_16 g, FX16_16 min, FX16_16 max) {
+	return (g < min)? min : ((g > max)? max : g);
+}
+
+static void AT_Set_Gains(void) {
+	FX16_16 ku, kp;
+	int32_t tu16;
+
+	ku = at_ku_sum/AT_RELAY_CAPTURES;
+	tu16 = at_tu16_sum/AT_RELAY_CAPTURES;
+	g_autotune_ku = ku;
+	g_autotune_tu_us = (tu16*CTL_PERIOD_NOW)/(16*24); // CTL_PERIOD_NOW counts at 24 MHz
+
+	kp = (ku*10)/32;	// Ku/3.2
+	plantPID_FX.dGain = AT_Clamp(kp, D_GAIN_FX_MIN, D_GAIN_FX_MAX);
+	plantPID_FX.pGain = AT_Clamp(((int64_t) kp*160)/(22*tu16), P_GAIN_FX_MIN, P_GAIN_FX_MAX); // Kp/(2.2*Tu)
+	plantPID_FX.iGain = 0;
+	plantPID_FX.iState = 0;
+}
+
+// Settling time of the pulse in the capture, -1 if it never enters the band
+static int AT_Settle_us(void) {
+	int start, end, set, i, d, last;
+
+	set = AT_Find_Pulse(&start, &end);
+	if (set == 0)
+		return -1;
+	last = start - 1;
+	for (i = start; i < end; i++) {
+		d = g_meas_sample[i] - set;
+		if ((d > set/AT_SETTLE_BAND_DIV) || (-d > set/AT_SETTLE_BAND_DIV))
+			last = i;
+	}
+	if (last >= end - 1)
+		return -1;
+	return ((last + 1 - start)*CTL_PERIOD_NOW)/24;
+}
+
+static void AT_Save_Gains(void) {
+	SPidFX g = plantPID_FX;
+
+#if USE_RUNTIME_PWM_PERIOD
+	// Saved at the reset period, where main() loads them
+	g.pGain = ((int64_t) g.pGain*PWM_PERIOD)/g_pwm_period;
+	g.iGain = ((int64_t) g.iGain*PWM_PERIOD)/g_pwm_period;
+	g.dGain = ((int64_t) g.dGain*PWM_PERIOD)/g_pwm_period;
+#endif
+	__disable_irq();	// ISRs run from flash, which is busy while programming
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, 0); // LED off until the control ISR runs again
+	NVM_Save_PID_Gains(&g);
+	__enable_irq();
+}
+
+void Autotune_Process_Capture(void) {
+	if (!Autotune_Running())
+		return;
+	if (at_skip) {
+		at_skip = 0;
+		return;
+	}
+	if (g_autotune_state == AT_Relay) {
+		at_captures++;
+		if (AT_Analyze_Relay() && (++at_good >= AT_RELAY_CAPTURES)) {
+			AT_Set_Gains();
+			at_skip = 1;
+			g_autotune_state = AT_Verify;
+			Control_Set_Mode(PID_FX);
+		} else if (at_captures >= AT_MAX_CAPTURES) {
+			g_autotune_settle_us = -1;
+			g_autotune_state = AT_Failed;
+			Control_Set_Mode(PID_FX); // gains unchanged
+		}
+	} else { // AT_Verify
+		g_autotune_settle_us = AT_Settle_us();
+		AT_Save_Gains();
+		g_autotune_state = AT_Done;
+	}
+}
+
+// UI: slide right to start tuning; the field shows the settling time
+void Autotune_Handler(UI_FIELD_T * fld, int v) {
+	if (v > 0)
+		Autotune_Start();
+}
@@ -0,0 +1,67 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "FX.h"
+#include "config.h"
+#include "control.h"
+#include "UI.h"
+
+/* Relay-feedback autotuner for PID_FX (USE_AUTOTUNE in control.h).
+ * Control mode Autotune replaces the PID with a relay around the flash
+ * current g_peak_set_current_mA: duty = bias +/- AT_RELAY_DUTY, by the sign
+ * of the error. The bias walks by AT_BIAS_STEP toward the duty cycle that
+ * centers the oscillation on the setpoint and is kept between pulses.
+ * The ISR cost is a compare and two adds.
+ *
+ * Thread_Draw_Waveforms hands each full scope capture to
+ * Autotune_Process_Capture before plotting it. From the second half of the
+ * pulse it measures the oscillation period Tu and amplitude a, giving the
+ * ultimate gain Ku = 4*AT_RELAY_DUTY/(pi*a). After AT_RELAY_CAPTURES good
+ * captures, Tyreus-Luyben PI gains are loaded into plantPID_FX:
+ *   Kp = Ku/3.2, Ti = 2.2*Tu
+ * UpdatePID_FX's output is added to the duty cycle, so the PI law is applied
+ * in incremental form: dGain (on the measurement difference) acts as Kp and
+ * pGain (on the error) as Kp*T/Ti, with T the control period; iGain is 0.
+ * One more capture under PID_FX measures the settling time, then the gains
+ * are saved to flash (nvm.h) and main() loads them at the next reset.
+ */
+
+#define AT_RELAY_DUTY (16)				// relay amplitude h, duty cycle counts
+#define AT_BIAS_STEP (2)					// bias change per sample, duty cycle counts
+#define AT_RELAY_CAPTURES (3)			// good captures averaged for Ku and Tu
+#define AT_MAX_CAPTURES (8)				// give up after this many relay captures
+#define AT_MIN_CROSSINGS (3)			// upward setpoint crossings needed in a capture
+#define AT_SETTLE_BAND_DIV (20)		// settling band: +/- set/20 (5%)
+
+typedef enum {AT_Idle, AT_Relay, AT_Verify, AT_Done, AT_Failed} AT_STATE_E;
+
+extern volatile AT_STATE_E g_autotune_state;
+extern volatile int g_autotune_settle_us;	// settling time with tuned gains, -1 if not settled
+extern volatile FX16_16 g_autotune_ku;		// ultimate gain, duty counts per mA
+extern volatile int g_autotune_tu_us;			// ultimate period
+extern volatile int g_autotune_bias;			// relay bias duty cycle
+
+void Autotune_Start(void);
+int Autotune_Running(void);
+void Autotune_Process_Capture(void); // call with g_scope_state == Full
+void Autotune_Handler(UI_FIELD_T * fld, int v);
+
+// Relay output for the control ISR in Autotune mode
+__STATIC_FORCEINLINE int Autotune_Relay(int set_mA, int measured_mA) {
+	int bias = g_autotune_bias;
+
+	if (set_mA <= 0)
+		return 0; // LED off between flashes; keep the bias for the next one
+	if (measured_mA < set_mA) {
+		if (bias < LIM_DUTY_CYCLE)
+			g_autotune_bias = bias += AT_BIAS_STEP;
+		return bias + AT_RELAY_DUTY;
+	}
+	if (bias > 0)
+		g_autotune_bias = bias -= AT_BIAS_STEP;
+	return bias - AT_RELAY_DUTY;
+}
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "control.h"
+#include "FX.h"
+#include "bench.h"
+#include "gain_sched.h"
+
+#ifndef SIM_HOST
+#include <MKL25Z4.h>
+#include <string.h>
+#include "LCD.h"
+#include "ST7789.h"
+#include "font.h"
+#include "colors.h"
+#include "ilc.h"
+#include "delay.h"
+#include "timers.h"
+#if ENABLE_COP_WATCHDOG
+#include "wdt.h"
+#endif
+#endif
+
+// Kernel operands are volatile so the calls can't be folded or hoisted
+static volatile FX16_16 bench_a = INT_TO_FX(37), bench_b = FL_TO_FX(-2.5), bench_r;
+static volatile MA_T bench_e = 3, bench_p = 72;
+static volatile DUTY_T bench_d;
+
+static void Bench_Multiply_FX(void) {
+	bench_r = Multiply_FX(bench_a, bench_b);
+}
+
+static void Bench_Add_FX(void) {
+	bench_r = Add_FX(bench_a, bench_b);
+}
+
+static void Bench_Subtract_FX(void) {
+	bench_r = Subtract_FX(bench_a, bench_b);
+}
+
+static void Bench_Multiply_Sat_FX(void) {
+	bench_r = Multiply_Sat_FX(bench_a, bench_b);
+}
+
+static void Bench_Add_Sat_FX(void) {
+	bench_r = Add_Sat_FX(bench_a, bench_b);
+}
+
+static void Bench_UpdatePID(void) {
+	bench_d = UpdatePID(&plantPID, bench_e, bench_p);
+}
+
+static void Bench_UpdatePID_FX(void) {
+	bench_r = UpdatePID_FX(&plantPID_FX, bench_a, bench_b);
+}
+
+static void Bench_Setup_Control(CTL_MODE_E m) {
+	g_enable_control = 1;
+	Control_Set_Mode(m);
+	g_set_current_mA = FLASH_CURRENT_MA;
+	g_duty_cycle = LIM_DUTY_CYCLE/2;
+}
+
+static void Bench_Setup_OpenLoop(void) { Bench_Setup_Control(OpenLoop); }
+static void Bench_Setup_BangBang(void) { Bench_Setup_Control(BangBang); }
+static void Bench_Setup_Incremental(void) { Bench_Setup_Control(Incremental); }
+static void Bench_Setup_Proportional(void) { Bench_Setup_Control(Proportional); }
+static void Bench_Setup_PID(void) { Bench_Setup_Control(PID); }
+static void Bench_Setup_PID_FX(void) { Bench_Setup_Control(PID_FX); }
+static void Bench_Setup_PID_FX_GS(void) { Bench_Setup_Control(PID_FX_GS); }
+static void Bench_Setup_ILC(void) { Bench_Setup_Control(ILC); }
+static void Bench_Setup_Deadbeat(void) { Bench_Setup_Control(Deadbeat); }
+
+// Whole ISR body: ADC read, scope state machine, control law, PWM update
+static void Bench_Control_HBLED(void) {
+	Control_HBLED();
+}
+
+#if USE_SPECIALIZED_CONTROL_ISR
+// Specialized body selected by Control_Set_Mode, called as the ISR does
+static void Bench_Control_HBLED_Fn(void) {
+	CONTROL_HBLED();
+}
+#endif
+
+const BENCH_KERNEL_T Bench_Kernels[] = {
+	{"Multiply_FX", NULL, Bench_Multiply_FX},
+	{"Add_FX", NULL, Bench_Add_FX},
+	{"Subtract_FX", NULL, Bench_Subtract_FX},
+	{"Mul_Sat_FX", NULL, Bench_Multiply_Sat_FX},
+	{"Add_Sat_FX", NULL, Bench_Add_Sat_FX},
+	{"UpdatePID", NULL, Bench_UpdatePID},
+	{"UpdatePID_FX", NULL, Bench_UpdatePID_FX},
+	{"Ctl OpenLoop", Bench_Setup_OpenLoop, Bench_Control_HBLED},
+	{"Ctl BangBang", Bench_Setup_BangBang, Bench_Control_HBLED},
+	{"Ctl Incr", Bench_Setup_Incremental, Bench_Control_HBLED},
+	{"Ctl Prop", Bench_Setup_Proportional, Bench_Control_HBLED},
+	{"Ctl PID", Bench_Setup_PID, Bench_Control_HBLED},
+	{"Ctl PID_FX", Bench_Setup_PID_FX, Bench_Control_HBLED},
+	{"Ctl PID_GS", Bench_Setup_PID_FX_GS, Bench_Control_HBLED},
+	{"Ctl ILC", Bench_Setup_ILC, Bench_Control_HBLED},
+	{"Ctl Deadbeat", Bench_Setup_Deadbeat, Bench_Control_HBLED},
+#if USE_SPECIALIZED_CONTROL_ISR
+	{"Spc OpenLoop", Bench_Setup_OpenLoop, Bench_Control_HBLED_Fn},
+	{"Spc BangBang", Bench_Setup_BangBang, Bench_Control_HBLED_Fn},
+	{"Spc Incr", Bench_Setup_Incremental, Bench_Control_HBLED_Fn},
+	{"Spc Prop", Bench_Setup_Proportional, Bench_Control_HBLED_Fn},
+	{"Spc PID", Bench_Setup_PID, Bench_Control_HBLED_Fn},
+	{"Spc PID_FX", Bench_Setup_PID_FX, Bench_Control_HBLED_Fn},
+	{"Spc PID_GS", Bench_Setup_PID_FX_GS, Bench_Control_HBLED_Fn},
+	{"Spc ILC", Bench_Setup_ILC, Bench_Control_HBLED_Fn},
+	{"Spc Deadbeat", Bench_Setup_Deadbeat, Bench_Control_HBLED_Fn},
+#endif
+};
+const int Bench_Num_Kernels = sizeof(Bench_Kernels)/sizeof(BENCH_KERNEL_T);
+_Static_assert(sizeof(Bench_Kernels)/sizeof(BENCH_KERNEL_T) <= BENCH_MAX_KERNELS,
+	"Bench_Kernels has more entries than BENCH_MAX_KERNELS results");
+
+/* Time each kernel call individually. mask is the timer's counter width,
+ * so a single wrap between the two reads is handled. The cost of one
+ * back-to-back pair of timer reads is measured first and removed. */
+int Bench_Run(BENCH_TIMER_FN now, uint32_t mask, uint32_t iterations, BENCH_RESULT_T * results) {
+	uint32_t t0, t1, d, overhead = 0xFFFFFFFF;
+	uint64_t sum;
+	int k, n = 0;
+
+	for (uint32_t i = 0; i < 16; i++) {
+		t0 = now();
+		t1 = now();
+		d = (t1 - t0) & mask;
+		if (d < overhead)
+			overhead = d;
+	}
+
+	for (k = 0; (k < Bench_Num_Kernels) && (k < BENCH_MAX_KERNELS); k++) {
+		if (Bench_Kernels[k].Setup)
+			Bench_Kernels[k].Setup();
+		Bench_Kernels[k].Kernel(); // warm up
+		results[k].Name = Bench_Kernels[k].Name;
+		results[k].Max = 0;
+		results[k].Min = 0xFFFFFFFF;
+		sum = 0;
+		for (uint32_t i = 0; i < iterations; i++) {
+			t0 = now();
+			Bench_Kernels[k].Kernel();
+			t1 = now();
+			d = (t1 - t0) & mask;
+			d = (d > overhead)? d - overhead : 0;
+			sum += d;
+			if (d > results[k].Max)
+				results[k].Max = d;
+			if (d < results[k].Min)
+				results[k].Min = d;
+		}
+		results[k].Mean = (uint32_t)(sum/iterations);
+		n++;
+#if !defined(SIM_HOST) && ENABLE_COP_WATCHDOG
+		WDT_Feed();
+#endif
+	}
+	return n;
+}
+
+#ifndef SIM_HOST
+BENCH_RESULT_T g_bench_results[BENCH_MAX_KERNELS]; // global to give debugger access
+// The ILC kernels learn into the trajectory; too large for the 768 byte main stack
+static int16_t saved_ilc_duty[ILC_SAMPLES];
+static int8_t saved_ilc_error[ILC_SAMPLES];
+
+// SysTick counts core clock cycles down from LOAD; return an up-count
+static uint32_t Bench_SysTick_Now(void) {
+	return SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
+}
+
+// Leave a page of results up for about 3 s
+static void Bench_Show_Page(void) {
+	int i;
+
+	for (i = 0; i < 60; i++) {
+		Delay(50);
+#if ENABLE_COP_WATCHDOG
+		WDT_Feed();
+#endif
+	}
+}
+
+/* Run before osKernelStart, with the buck converter initialized (so TPM0 and
+ * ADC0 are clocked). SysTick is borrowed as a free-running cycle counter;
+ * the RTOS reprograms it when the kernel starts. Interrupts are disabled so
+ * the control ISR can't land inside a measurement. The control state the
+ * kernels change is restored afterwards. */
+void Bench_Run_On_Target(void) {
+	CTL_MODE_E saved_mode = control_mode;
+	int saved_duty = g_duty_cycle, saved_ilc_pos = g_ilc_pos, n, i, row, rows;
+	SPid saved_pid = plantPID;
+	SPidFX saved_pid_fx = plantPID_FX, saved_pid_fx_gs = plantPID_FX_GS;
+	SCOPE_CONTEXT_T saved_scope;
+	char buf[32];
+
+	Control_Scope_Save(&saved_scope);
+	memcpy(saved_ilc_duty, (const void *) g_ilc_duty, sizeof(saved_ilc_duty));
+	memcpy(saved_ilc_error, (const void *) g_ilc_error, sizeof(saved_ilc_error));
+
+	SysTick->CTRL = 0;
+	SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
+	__disable_irq();
+	n = Bench_Run(Bench_SysTick_Now, SysTick_LOAD_RELOAD_Msk, BENCH_TARGET_ITERATIONS, g_bench_results);
+	Control_Set_Mode(saved_mode);
+	g_duty_cycle = saved_duty;
+	plantPID = saved_pid;
+	plantPID_FX = saved_pid_fx;
+	plantPID_FX_GS = saved_pid_fx_gs;
+	Control_Scope_Restore(&saved_scope);
+	memcpy((void *) g_ilc_duty, saved_ilc_duty, sizeof(saved_ilc_duty));
+	memcpy((void *) g_ilc_error, saved_ilc_error, sizeof(saved_ilc_error));
+	g_ilc_pos = saved_ilc_pos;
+	g_set_current_mA = 0;
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
+	__enable_irq();
+	SysTick->CTRL = 0;
+
+	// Small font: the table needs 26 columns and a row per kernel. Kernels
+	// that don't fit under the header go on further pages.
+	LCD_Text_Init(0);
+	LCD_Text_Set_Colors(&white, &black);
+	rows = LCD_MAX_ROWS-1;
+	for (i = 0; i < n; i++) {
+		row = i % rows;
+		if (row == 0) {
+			if (i > 0)
+				Bench_Show_Page();
+			LCD_Erase();
+			snprintf(buf, sizeof(buf), "Cycles mean  max  %%/%d", BENCH_CTL_BUDGET_CYCLES);
+			LCD_Text_PrintStr_RC(0, 0, buf);
+		}
+		snprintf(buf, sizeof(buf), "%-12s%5lu%5lu%3lu%%", g_bench_results[i].Name,
+			(unsigned long) g_bench_results[i].Mean, (unsigned long) g_bench_results[i].Max,
+			(unsigned long) (100*g_bench_results[i].Max)/BENCH_CTL_BUDGET_CYCLES);
+		LCD_Text_PrintStr_RC(row+1, 0, buf);
+	}
+	Bench_Show_Page();
+	LCD_Text_Init(1);
+}
+#endif // SIM_HOST
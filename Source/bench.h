@@ -0,0 +1,45 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include "config.h"
+#include "control.h"
+
+/* Controller kernel microbenchmarks.
+ * The same kernel table is timed on the target (SysTick, core cycles) and
+ * on the host simulator (Simulator/bench_main.c, nanoseconds).
+ * Enable the on-target run with ENABLE_KERNEL_BENCHMARK in config.h.
+ */
+
+#define BENCH_TARGET_ITERATIONS (256)
+#define BENCH_MAX_KERNELS (32)	// sizes the result arrays; bench.c checks the table fits
+
+// Core cycles available per control update: CTL_PERIOD is in TPM counts
+// of the up/down counter, so one control period is 2*CTL_PERIOD cycles at 48 MHz.
+#define BENCH_CTL_BUDGET_CYCLES (2*CTL_PERIOD)
+
+typedef struct {
+	const char * Name;
+	void (*Setup)(void);	// called once before timing, may be NULL
+	void (*Kernel)(void);	// one call of the code under test
+} BENCH_KERNEL_T;
+
+typedef struct {
+	const char * Name;
+	uint32_t Mean, Max, Min; // timer ticks per call, overhead removed
+} BENCH_RESULT_T;
+
+// Timestamp source, counting up
+typedef uint32_t (*BENCH_TIMER_FN)(void);
+
+extern const BENCH_KERNEL_T Bench_Kernels[];
+extern const int Bench_Num_Kernels;
+
+int Bench_Run(BENCH_TIMER_FN now, uint32_t mask, uint32_t iterations, BENCH_RESULT_T * results);
+
+#ifndef SIM_HOST
+extern BENCH_RESULT_T g_bench_results[BENCH_MAX_KERNELS];
+void Bench_Run_On_Target(void);
+#endif
+
+#endif // BENCH_H
@@ -12,6 +12,35 @@
 #include "LEDs.h"
 #include "UI.h"
 #include "FX.h"
+#include "ADC.h"
+#include "gain_sched.h"
+#include "ilc.h"
+#include "deadbeat.h"
+#include "waveform.h"
+#if USE_CURRENT_PREDICTOR
+#include "predictor.h"
+#endif
+#if USE_DUTY_FEEDFORWARD
+#include "feedforward.h"
+#endif
+#if USE_AUTOTUNE
+#include "autotune.h"
+#endif
+#if USE_SETPOINT_SHAPING
+#include "setpoint_shape.h"
+#endif
+#if USE_DITHERED_PWM
+#include "pwm_dither.h"
+#endif
+#if USE_ADC_OVERSAMPLING
+#include "adc_decim.h"
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+#include "overcurrent.h"
+#endif
+#if USE_DMA_SETPOINT
+#include "setpoint_dma.h"
+#endif
 
 #if SCOPE_SYNC_WITH_RTOS
 #include <cmsis_os2.h>
@@ -20,6 +49,29 @@ osEventFlagsId_t scope_event_flags;
 #endif
 
 volatile int g_duty_cycle = 5;  // global to give debugger access
+volatile int g_adc_calibrated = 0; // 1 if ADC_Calibrate passed at startup
+#if ENABLE_OVERCURRENT_TRIP
+volatile int g_overcurrent_trips = 0;
+#endif
+#if USE_RUNTIME_PWM_PERIOD
+volatile int g_pwm_period = PWM_PERIOD;
+#define PWM_SCALED(x) ((FX16_16)(((int64_t)(x)*g_pwm_period)/PWM_PERIOD))
+#else
+#define PWM_SCALED(x) (x)
+#endif
+#if USE_DITHERED_PWM
+volatile int g_duty_frac = 0;
+volatile int32_t g_pwm_duty_q = 5 << DITHER_BITS;
+volatile int32_t g_pwm_dither_err = 0;
+#endif
+#if USE_ADC_SAMPLE_PHASE
+volatile int g_adc_sample_phase = ADC_SAMPLE_PHASE_DEF; // 48 MHz counts after the TPM0 overflow
+#endif
+#if USE_ADC_OVERSAMPLING
+volatile uint32_t g_adc_decim_sum = 0;
+volatile int g_adc_decim_n = 0;
+volatile uint16_t g_adc_decim_result = 0;
+#endif
 
 volatile int g_enable_flash = 1;
 volatile int g_peak_set_current_mA = FLASH_CURRENT_MA; // Peak flash current
@@ -33,7 +85,7 @@ volatile int g_set_current_code = 0; 				// Default starting LED current, equiva
 volatile int g_measured_current_mA = 0;
 volatile int error= 0;
 
-int32_t pGain_8 = PGAIN_8; // proportional gain numerator scaled by 2^8
+DUTY_GAIN_T pGain_8 = PGAIN_8; // proportional gain numerator scaled by 2^8
 
 volatile SCOPE_STATE_E g_scope_state = Armed; 
 volatile __ALIGNED(256) uint16_t g_set_sample[SAM_BUF_SIZE];
@@ -41,17 +93,27 @@ volatile __ALIGNED(256) uint16_t g_meas_sample[SAM_BUF_SIZE];
 
 SPid plantPID = {0, // dState
 	0, // iState
-	LIM_DUTY_CYCLE, // iMax
-	-LIM_DUTY_CYCLE, // iMin
-	P_GAIN_FL, // pGain
-	I_GAIN_FL, // iGain
-	D_GAIN_FL  // dGain
+	DEF_LIM_DUTY_CYCLE, // iMax
+	-DEF_LIM_DUTY_CYCLE, // iMin
+	FL_TO_DUTY_GAIN(P_GAIN_FL), // pGain
+	FL_TO_DUTY_GAIN(I_GAIN_FL), // iGain
+	FL_TO_DUTY_GAIN(D_GAIN_FL)  // dGain
 };
 
 SPidFX plantPID_FX = {FL_TO_FX(0), // dState
 	FL_TO_FX(0), // iState
-	FL_TO_FX(LIM_DUTY_CYCLE), // iMax
-	FL_TO_FX(-LIM_DUTY_CYCLE), // iMin
+	FL_TO_FX(DEF_LIM_DUTY_CYCLE), // iMax
+	FL_TO_FX(-DEF_LIM_DUTY_CYCLE), // iMin
+	P_GAIN_FX, // pGain
+	I_GAIN_FX, // iGain
+	D_GAIN_FX  // dGain
+};
+
+// Gains loaded from Gain_Sched_Table every sample
+SPidFX plantPID_FX_GS = {FL_TO_FX(0), // dState
+	FL_TO_FX(0), // iState
+	FL_TO_FX(DEF_LIM_DUTY_CYCLE), // iMax
+	FL_TO_FX(-DEF_LIM_DUTY_CYCLE), // iMin
 	P_GAIN_FX, // pGain
 	I_GAIN_FX, // iGain
 	D_GAIN_FX  // dGain
@@ -66,34 +128,34 @@ void Validate_PID_Gains(void) {
 	// Check P gain - must be within valid range
 	if (plantPID_FX.pGain < P_GAIN_FX_MIN || plantPID_FX.pGain > P_GAIN_FX_MAX) {
 		// P gain is corrupted - restore default
-		plantPID_FX.pGain = P_GAIN_FX;
+		plantPID_FX.pGain = PWM_SCALED(P_GAIN_FX);
 	}
 	
 	// Check I gain - must be within valid range
 	// The fault TR_PID_FX_Gains sets iGain = -1000, which is negative
 	if (plantPID_FX.iGain < I_GAIN_FX_MIN || plantPID_FX.iGain > I_GAIN_FX_MAX) {
 		// I gain is corrupted - restore default
-		plantPID_FX.iGain = I_GAIN_FX;
+		plantPID_FX.iGain = PWM_SCALED(I_GAIN_FX);
 	}
 	
 	// Check D gain - must be within valid range
 	if (plantPID_FX.dGain < D_GAIN_FX_MIN || plantPID_FX.dGain > D_GAIN_FX_MAX) {
 		// D gain is corrupted - restore default
-		plantPID_FX.dGain = D_GAIN_FX;
+		plantPID_FX.dGain = PWM_SCALED(D_GAIN_FX);
 	}
 	
 	// Also validate integrator state limits (iMax, iMin)
 	// These should always be positive/negative duty cycle limits
-	if (plantPID_FX.iMax < 0 || plantPID_FX.iMax > FL_TO_FX(2*LIM_DUTY_CYCLE)) {
-		plantPID_FX.iMax = FL_TO_FX(LIM_DUTY_CYCLE);
+	if (plantPID_FX.iMax < 0 || plantPID_FX.iMax > INT_TO_FX(2*LIM_DUTY_CYCLE)) {
+		plantPID_FX.iMax = INT_TO_FX(LIM_DUTY_CYCLE);
 	}
-	if (plantPID_FX.iMin > 0 || plantPID_FX.iMin < FL_TO_FX(-2*LIM_DUTY_CYCLE)) {
-		plantPID_FX.iMin = FL_TO_FX(-LIM_DUTY_CYCLE);
+	if (plantPID_FX.iMin > 0 || plantPID_FX.iMin < INT_TO_FX(-2*LIM_DUTY_CYCLE)) {
+		plantPID_FX.iMin = INT_TO_FX(-LIM_DUTY_CYCLE);
 	}
 }
 
-float UpdatePID(SPid * pid, float error, float position){
-	float pTerm, dTerm, iTerm;
+DUTY_T UpdatePID(SPid * pid, MA_T error, MA_T position){
+	int32_t pTerm, dTerm, iTerm; // duty counts, Q24.8
 
 	// calculate the proportional term
 	pTerm = pid->pGain * error;
@@ -107,38 +169,145 @@ float UpdatePID(SPid * pid, float error, float position){
 	dTerm = pid->dGain * (position - pid->dState);
 	pid->dState = position;
 
-	return pTerm + iTerm - dTerm;
+	return Duty_From_Gain_Sum(pTerm + iTerm - dTerm);
 }
 
 FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX){
 	FX16_16 pTerm, dTerm, iTerm, diff, ret_val;
 
+	// Inline saturating operations from FX.h: large gains or errors clamp
+	// instead of wrapping around and flipping the sign of the correction.
 	// calculate the proportional term
-	pTerm = Multiply_FX(pid->pGain, error_FX);
+	pTerm = Multiply_Sat_FX(pid->pGain, error_FX);
 
 	// calculate the integral state with appropriate limiting
-	pid->iState = Add_FX(pid->iState, error_FX);
+	pid->iState = Add_Sat_FX(pid->iState, error_FX);
 	if (pid->iState > pid->iMax) 
 		pid->iState = pid->iMax;
 	else if (pid->iState < pid->iMin) 
 		pid->iState = pid->iMin;
 	
-	iTerm = Multiply_FX(pid->iGain, pid->iState); // calculate the integral term
-	diff = Subtract_FX(position_FX, pid->dState);
-	dTerm = Multiply_FX(pid->dGain, diff);
+	iTerm = Multiply_Sat_FX(pid->iGain, pid->iState); // calculate the integral term
+	diff = Subtract_Sat_FX(position_FX, pid->dState);
+	dTerm = Multiply_Sat_FX(pid->dGain, diff);
 	pid->dState = position_FX;
 
-	ret_val = Add_FX(pTerm, iTerm);
-	ret_val = Subtract_FX(ret_val, dTerm);
+	ret_val = Add_Sat_FX(pTerm, iTerm);
+	ret_val = Subtract_Sat_FX(ret_val, dTerm);
 	return ret_val;
 }
 
-void Control_HBLED(void) {
+#if USE_ADAPTIVE_CTL_RATE
+//=============================================================
+// Adaptive control rate
+//=============================================================
+volatile uint32_t g_ctl_updates_run = 0;
+volatile uint32_t g_ctl_updates_skipped = 0;
+static volatile int ctl_fast_window = 0; // PWM periods left at the fast rate
+static uint32_t ctl_rate_divider = 1;
+static int ctl_rate_periods = 0; // PWM periods since the last control update
+// PID_FX output scale: PWM periods since the last update over SW_CTL_FREQ_DIV_FACTOR
+static volatile FX16_16 ctl_rate_scale_FX = INT_TO_FX(1);
+#define CTL_RATE_SCALE_PER_PERIOD_FX (FL_TO_FX(1.0/SW_CTL_FREQ_DIV_FACTOR))
+static int ilc_step_per_period = ILC_STEP_OF(1, PWM_PERIOD); // ILC position per PWM period
+
+// Called every PWM period by TPM0_IRQHandler. Returns 1 if a control update
+// (ADC conversion, then Control_HBLED) should start in this period.
+int Control_Rate_Tick(void) {
+	uint32_t div;
+	int err;
+	
+	if ((ctl_fast_window > 0) || (g_scope_state == Triggered)) {
+		if (ctl_fast_window > 0)
+			ctl_fast_window--;
+		div = ADAPTIVE_CTL_FAST_DIV_FACTOR;
+	} else {
+		err = g_set_current_mA - g_measured_current_mA;
+		if (err < 0)
+			err = -err;
+		div = (err <= ADAPTIVE_CTL_STABLE_ERR_mA)? ADAPTIVE_CTL_SLOW_DIV_FACTOR : SW_CTL_FREQ_DIV_FACTOR;
+	}
+	if (ctl_rate_divider > div) // speeding up takes effect now
+		ctl_rate_divider = div;
+	ctl_rate_periods++;
+	if (--ctl_rate_divider == 0) {
+		ctl_rate_divider = div;
+		ctl_rate_scale_FX = ctl_rate_periods*CTL_RATE_SCALE_PER_PERIOD_FX;
+		g_ilc_step = ctl_rate_periods*ilc_step_per_period;
+		ctl_rate_periods = 0;
+		g_ctl_updates_run++;
+		return 1;
+	}
+	g_ctl_updates_skipped++;
+	return 0;
+}
+
+// Run at the fast rate for the next ADAPTIVE_CTL_FAST_WINDOW PWM periods
+void Control_Rate_Boost(void) {
+	ctl_fast_window = ADAPTIVE_CTL_FAST_WINDOW;
+}
+#endif
+
+// Scope and trigger state shared by the generic and specialized ISR bodies
+static int sample_idx = 0;
+static int prev_set_current_mA = 0;
+static const int threshold_mA = SCOPE_TRIGGER_THRESHOLD_mA;
+
+void Control_Scope_Save(SCOPE_CONTEXT_T * c) {
+	c->State = g_scope_state;
+	c->Sample_Idx = sample_idx;
+	c->Prev_Set_mA = prev_set_current_mA;
+}
+
+void Control_Scope_Restore(const SCOPE_CONTEXT_T * c) {
+	g_scope_state = c->State;
+	sample_idx = c->Sample_Idx;
+	prev_set_current_mA = c->Prev_Set_mA;
+}
+
+#if USE_DUTY_FEEDFORWARD
+// On a setpoint step, jump to the learned duty cycle and clear the integrator.
+// Within a shaped pulse (g_wave_varying) the PID tracks the setpoint instead.
+// Returns 1 to skip this sample's PID update: its error predates the jump.
+__STATIC_FORCEINLINE int Control_Feedforward(SPidFX * pid, int set_step) {
+	if (set_step) {
+		g_duty_cycle = g_ff_duty = FF_Duty(g_set_current_mA);
+		pid->iState = 0;
+	}
+	return set_step;
+}
+#endif
+
+// Add a PID_FX output to the duty cycle. The PID_FX gains are per update at
+// SW_CTL_FREQ_DIV_FACTOR PWM periods; with USE_ADAPTIVE_CTL_RATE the output
+// is scaled to the periods since the last update, so the loop gain in time
+// does not change with the rate.
+__STATIC_FORCEINLINE void Control_Add_Duty_FX(FX16_16 change_FX) {
+#if USE_ADAPTIVE_CTL_RATE
+	change_FX = Multiply_Sat_FX(change_FX, ctl_rate_scale_FX);
+#endif
+#if USE_DITHERED_PWM
+	// Carry the fraction for the modulator. Rounds down, not toward zero, so
+	// small negative changes accumulate like positive ones.
+	change_FX = Add_Sat_FX(change_FX, g_duty_frac << (16-DITHER_BITS));
+	g_duty_cycle += change_FX >> 16;
+	g_duty_frac = (change_FX >> (16-DITHER_BITS)) & (DITHER_ONE-1);
+#else
+	g_duty_cycle += FX_TO_INT(change_FX);
+#endif
+}
+
+/* Body of the control ISR. Always inlined: called with run-time arguments it
+ * is the generic Control_HBLED; called with constant arguments the compiler
+ * folds the mode switch and the enable test, leaving one specialized body
+ * per mode (USE_SPECIALIZED_CONTROL_ISR). */
+__STATIC_FORCEINLINE void Control_HBLED_Body(const CTL_MODE_E mode, const int enabled) {
 	uint16_t res;
-	FX16_16 change_FX, error_FX;
-	static int sample_idx = 0;
-	static int prev_set_current_mA = 0;
-	static int threshold_mA = SCOPE_TRIGGER_THRESHOLD_mA;
+	FX16_16 change_FX, error_FX, feedback_FX;
+	int set_mA;
+#if USE_DUTY_FEEDFORWARD
+	int set_step;
+#endif
 	
 	DEBUG_START(DBG_CONTROLLER_POS);
 	
@@ -148,8 +317,21 @@ void Control_HBLED(void) {
 	while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK))
 		; // wait until end of conversion
 #endif
+#if USE_ADC_OVERSAMPLING
+	res = g_adc_decim_result; // mean of this control period's conversions
+#else
 	res = ADC0->R[0];
-	g_measured_current_mA = (res*1500)>>16; // Extra Credit: Explain why this doesn't work: V_REF_MV*MA_SCALING_FACTOR)/(ADC_FULL_SCALE*R_SENSE)
+#endif
+	g_measured_current_mA = ADC_Code_To_mA(res);
+#if USE_DMA_SETPOINT
+	Setpoint_DMA_Update(); // setpoint of the run the DMA is playing
+#endif
+#if USE_DUTY_FEEDFORWARD
+	// A shaped waveform moves the setpoint every ms within the pulse: only
+	// its edges from and to 0 mA are steps
+	set_step = (g_set_current_mA != prev_set_current_mA) && g_ff_valid
+		&& (!g_wave_varying || (g_set_current_mA == 0) || (prev_set_current_mA == 0));
+#endif
 
 	//=============================================================
 	// SCOPE SYNCHRONIZATION: ISR Side
@@ -263,50 +445,307 @@ void Control_HBLED(void) {
 	
 	prev_set_current_mA = g_set_current_mA;
 	
-	if (g_enable_control) {
-		switch (control_mode) {
+#if USE_SETPOINT_SHAPING
+	set_mA = Shape_Setpoint(g_set_current_mA);
+#else
+	set_mA = g_set_current_mA;
+#endif
+#if USE_CURRENT_PREDICTOR
+	feedback_FX = Predict_Current_FX(g_measured_current_mA, g_duty_cycle); // g_duty_cycle still applies
+#else
+	feedback_FX = INT_TO_FX(g_measured_current_mA);
+#endif
+	
+	if (enabled) {
+		switch (mode) {
 			case OpenLoop:
 					// don't do anything!
+#if USE_DUTY_FEEDFORWARD
+				FF_Learn_Step(g_measured_current_mA); // startup sweep, if running
+#endif
 				break;
 			case BangBang:
-				if (g_measured_current_mA < g_set_current_mA)
+				if (g_measured_current_mA < set_mA)
 					g_duty_cycle = LIM_DUTY_CYCLE;
 				else
 					g_duty_cycle = 0;
 				break;
 			case Incremental:
-				if (g_measured_current_mA < g_set_current_mA)
+				if (g_measured_current_mA < set_mA)
 					g_duty_cycle += INC_STEP;
 				else
 					g_duty_cycle -= INC_STEP;
 				break;
 			case Proportional:
-				g_duty_cycle += (pGain_8*(g_set_current_mA - g_measured_current_mA))/256; //  - 1;
+				g_duty_cycle += (pGain_8*(set_mA - g_measured_current_mA))/256; //  - 1;
 			break;
 			case PID:
-				g_duty_cycle += UpdatePID(&plantPID, g_set_current_mA - g_measured_current_mA, g_measured_current_mA);
+				g_duty_cycle += UpdatePID(&plantPID, set_mA - g_measured_current_mA, g_measured_current_mA);
 				break;
 			case PID_FX:
-				error_FX = INT_TO_FX(g_set_current_mA - g_measured_current_mA);
-				change_FX = UpdatePID_FX(&plantPID_FX, error_FX, INT_TO_FX(g_measured_current_mA));
-				g_duty_cycle += FX_TO_INT(change_FX);
+#if USE_DUTY_FEEDFORWARD
+				if (Control_Feedforward(&plantPID_FX, set_step))
+					break;
+#endif
+				error_FX = INT_TO_FX(set_mA) - feedback_FX;
+				change_FX = UpdatePID_FX(&plantPID_FX, error_FX, feedback_FX);
+				Control_Add_Duty_FX(change_FX);
+			break;
+			case PID_FX_GS:
+				Gain_Sched_Update(&plantPID_FX_GS, g_set_current_mA); // operating point: unshaped
+#if USE_DUTY_FEEDFORWARD
+				if (Control_Feedforward(&plantPID_FX_GS, set_step))
+					break;
+#endif
+				error_FX = INT_TO_FX(set_mA) - feedback_FX;
+				change_FX = UpdatePID_FX(&plantPID_FX_GS, error_FX, feedback_FX);
+				Control_Add_Duty_FX(change_FX);
 			break;
+			case ILC:
+				g_duty_cycle = ILC_Update(set_mA, g_measured_current_mA);
+			break;
+			case Deadbeat:
+				g_duty_cycle = Deadbeat_Update(set_mA, g_measured_current_mA, g_duty_cycle);
+			break;
+#if USE_AUTOTUNE
+			case Autotune:
+				g_duty_cycle = Autotune_Relay(g_set_current_mA, g_measured_current_mA);
+			break;
+#endif
 			default:
 				break;
 		}
 	
 		// Update PWM controller with duty cycle
+#if USE_DITHERED_PWM
+		if (g_duty_cycle < 0) {
+			g_duty_cycle = 0;
+			g_duty_frac = 0;
+		} else if (g_duty_cycle >= LIM_DUTY_CYCLE) {
+			g_duty_cycle = LIM_DUTY_CYCLE;
+			g_duty_frac = 0;
+		}
+		g_pwm_duty_q = (g_duty_cycle << DITHER_BITS) + g_duty_frac;
+		PWM_Dither_Step(); // this period's step: the new duty cycle applies at the next reload
+#else
 		if (g_duty_cycle < 0)
 			g_duty_cycle = 0;
 		else if (g_duty_cycle > LIM_DUTY_CYCLE)
 			g_duty_cycle = LIM_DUTY_CYCLE;
 		PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
-	} // if g_enable_control
+#endif
+	} // if enabled
 	
-	// Increment sample index and wrap at SAM_BUF_SIZE
 	DEBUG_STOP(DBG_CONTROLLER_POS);
 }
 
+// Generic control ISR body: dispatches on control_mode and g_enable_control every sample
+void Control_HBLED(void) {
+	Control_HBLED_Body(control_mode, g_enable_control);
+}
+
+#if USE_SPECIALIZED_CONTROL_ISR
+//=============================================================
+// Specialized control ISR bodies, one per CTL_MODE_E plus one for
+// control disabled. Control_Select_ISR points Control_HBLED_Fn at the
+// right one; the ISR calls through the pointer with CONTROL_HBLED().
+//=============================================================
+#define CONTROL_HBLED_VARIANT(m) \
+	static void Control_HBLED_##m(void) { Control_HBLED_Body(m, 1); }
+
+CONTROL_HBLED_VARIANT(OpenLoop)
+CONTROL_HBLED_VARIANT(BangBang)
+CONTROL_HBLED_VARIANT(Incremental)
+CONTROL_HBLED_VARIANT(Proportional)
+CONTROL_HBLED_VARIANT(PID)
+CONTROL_HBLED_VARIANT(PID_FX)
+CONTROL_HBLED_VARIANT(PID_FX_GS)
+CONTROL_HBLED_VARIANT(ILC)
+CONTROL_HBLED_VARIANT(Deadbeat)
+CONTROL_HBLED_VARIANT(Autotune)
+
+static void Control_HBLED_Disabled(void) {
+	Control_HBLED_Body(OpenLoop, 0);
+}
+
+static void (* const Control_HBLED_Variants[MODE_COUNT])(void) = {
+	[OpenLoop] = Control_HBLED_OpenLoop,
+	[BangBang] = Control_HBLED_BangBang,
+	[Incremental] = Control_HBLED_Incremental,
+	[Proportional] = Control_HBLED_Proportional,
+	[PID] = Control_HBLED_PID,
+	[PID_FX] = Control_HBLED_PID_FX,
+	[PID_FX_GS] = Control_HBLED_PID_FX_GS,
+	[ILC] = Control_HBLED_ILC,
+	[Deadbeat] = Control_HBLED_Deadbeat,
+	[Autotune] = Control_HBLED_Autotune,
+};
+
+void (* volatile Control_HBLED_Fn)(void) = Control_HBLED; // generic until first selection
+
+// Call after changing control_mode or g_enable_control.
+// A single pointer store, so the ISR sees either the old or the new body.
+void Control_Select_ISR(void) {
+	void (* fn)(void) = Control_HBLED;	// fall back to generic for unknown modes
+	
+	if (!g_enable_control)
+		fn = Control_HBLED_Disabled;
+	else if ((control_mode < MODE_COUNT) && (Control_HBLED_Variants[control_mode] != NULL))
+		fn = Control_HBLED_Variants[control_mode];
+	Control_HBLED_Fn = fn;
+}
+#else
+void Control_Select_ISR(void) {
+	// Generic ISR reads control_mode and g_enable_control directly
+}
+#endif // USE_SPECIALIZED_CONTROL_ISR
+
+#if ENABLE_OVERCURRENT_TRIP
+// Give PTE31 back to TPM0 after a trip. Duty cycle 0 is latched first, so the
+// output restarts off and the control loop ramps it up.
+void Overcurrent_Clear(void) {
+	PORTE->PCR[HBLED_PWM_PIN] = (PORTE->PCR[HBLED_PWM_PIN] & ~PORT_PCR_MUX_MASK) | PORT_PCR_MUX(HBLED_PWM_MUX);
+}
+#endif
+
+void Control_Set_Mode(CTL_MODE_E m) {
+#if USE_RUNTIME_PWM_PERIOD
+	if ((m == PID_FX_GS) || (m == Deadbeat))
+		Control_Set_PWM_Period(PWM_PERIOD); // their tables were generated at PWM_PERIOD
+#endif
+	control_mode = m;
+#if USE_DITHERED_PWM
+	g_duty_frac = 0; // only the PID_FX modes produce a fraction
+#endif
+	Control_Select_ISR();
+}
+
+#if USE_SYNC_HW_CTL_FREQ_DIV
+// (Re)arm the trigger timer for PWM period `period`: it starts on TPM0's next
+// overflow, so the control period stays aligned with the PWM period.
+static void Control_Arm_Trigger(int period) {
+#if USE_ADC_SAMPLE_PHASE
+	TPM_Init_Trigger_Phase(CTL_TRIGGER_TPM, 2*period*HW_CTL_FREQ_DIV_FACTOR, g_adc_sample_phase, 
+		TPM0_OVERFLOW_TRGSEL);
+#else
+	TPM_Init_Trigger_Divider(CTL_TRIGGER_TPM, 2*period*HW_CTL_FREQ_DIV_FACTOR, TPM0_OVERFLOW_TRGSEL);
+#endif
+}
+#endif
+
+#if USE_ADC_SAMPLE_PHASE
+/* Move the conversion to `counts` (48 MHz) after the TPM0 overflow, limited to
+ * one control period. The trigger timer restarts on the next TPM0 overflow, so
+ * the control period around the change is longer or shorter by the difference. */
+void Control_Set_Sample_Phase(int counts) {
+	if (counts < 1)
+		counts = 1;
+	else if (counts > 2*CTL_PERIOD_NOW)
+		counts = 2*CTL_PERIOD_NOW;
+	__disable_irq();
+	g_adc_sample_phase = counts;
+	Control_Arm_Trigger(PWM_PERIOD_NOW);
+	__enable_irq();
+}
+#endif
+
+#if USE_RUNTIME_PWM_PERIOD
+static const int16_t PWM_Periods[] = PWM_PERIOD_TABLE;
+
+static FX16_16 Scale_FX(FX16_16 x, int num, int den) {
+	return (FX16_16) (((int64_t) x*num)/den);
+}
+
+// Duty counts and gains in duty counts per mA scale with the PWM period
+// (the default gains are proportional to CTL_PERIOD). Integrator limits
+// follow LIM_DUTY_CYCLE. The integrator state is accumulated mA error,
+// which does not depend on the period: scaling it as well as iGain would
+// scale the I term by the square of the ratio. It is only clamped.
+static void Scale_PID_FX(SPidFX * pid, int num, int den) {
+	pid->pGain = Scale_FX(pid->pGain, num, den);
+	pid->iGain = Scale_FX(pid->iGain, num, den);
+	pid->dGain = Scale_FX(pid->dGain, num, den);
+	pid->iMax = INT_TO_FX(num-1);
+	pid->iMin = -INT_TO_FX(num-1);
+	if (pid->iState > pid->iMax)
+		pid->iState = pid->iMax;
+	else if (pid->iState < pid->iMin)
+		pid->iState = pid->iMin;
+}
+
+/* Switch TPM0 to a PWM period from PWM_PERIOD_TABLE. Returns 1 on success,
+ * 0 if the period is not in the table or the control mode's tables were
+ * generated at PWM_PERIOD. The rescaling of gains, limits, duty cycle and
+ * learned duty tables, the MOD and CnV writes and the trigger divider
+ * restart happen with interrupts disabled: the control ISR never sees a mix
+ * of old and new values, and its g_ilc_duty updates are not lost to the
+ * rescaling. The tables use a Q12 ratio instead of a divide per entry to
+ * keep that short. TPM0 loads MOD and CnV together at the next reload, and
+ * the trigger timer restarts on that same overflow. */
+int Control_Set_PWM_Period(int period) {
+	int old = g_pwm_period, i, n;
+	int32_t ratio;
+
+	for (i = 0; (i < sizeof(PWM_Periods)/sizeof(PWM_Periods[0])) && (PWM_Periods[i] != period); i++)
+		;
+	if (i >= sizeof(PWM_Periods)/sizeof(PWM_Periods[0]))
+		return 0;
+	if (period == old)
+		return 1;
+	if ((period != PWM_PERIOD) && ((control_mode == PID_FX_GS) || (control_mode == Deadbeat)))
+		return 0;
+
+	ratio = (period << 12)/old;
+
+	__disable_irq();
+	g_pwm_period = period;
+	// Learned duty tables
+	for (n = 0; n < ILC_SAMPLES; n++)
+		g_ilc_duty[n] = (g_ilc_duty[n]*ratio) >> 12;
+#if USE_ADAPTIVE_CTL_RATE
+	ilc_step_per_period = ILC_STEP_OF(1, period);
+#else
+	g_ilc_step = ILC_STEP_OF(CTL_FREQ_DIV_FACTOR, period);
+#endif
+	g_ilc_gain = ((ILC_LEARN_GAIN << ILC_GAIN_BITS)*period)/PWM_PERIOD;
+#if USE_DUTY_FEEDFORWARD
+	for (n = 0; n < FF_ENTRIES; n++)
+		g_ff_duty_table[n] = (g_ff_duty_table[n]*ratio) >> 12;
+#endif
+	Scale_PID_FX(&plantPID_FX, period, old);
+	Scale_PID_FX(&plantPID_FX_GS, period, old); // limits and state; gains come from the table
+	plantPID.pGain = (plantPID.pGain*period)/old;
+	plantPID.iGain = (plantPID.iGain*period)/old;
+	plantPID.dGain = (plantPID.dGain*period)/old;
+	plantPID.iMax = period-1;
+	plantPID.iMin = -(period-1);
+	if (plantPID.iState > plantPID.iMax)
+		plantPID.iState = plantPID.iMax;
+	else if (plantPID.iState < plantPID.iMin)
+		plantPID.iState = plantPID.iMin;
+	pGain_8 = (pGain_8*period)/old;
+#if USE_ADC_SAMPLE_PHASE
+	g_adc_sample_phase = (g_adc_sample_phase*period)/old; // same point of the waveform
+#endif
+#if USE_AUTOTUNE
+	g_autotune_bias = (g_autotune_bias*period)/old;
+#endif
+	g_duty_cycle = (g_duty_cycle*period)/old;
+	if (g_duty_cycle > LIM_DUTY_CYCLE)
+		g_duty_cycle = LIM_DUTY_CYCLE;
+#if USE_DITHERED_PWM
+	PWM_Dither_Set(g_duty_cycle);
+#endif
+	TPM0->MOD = period;
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	Control_Arm_Trigger(period);
+#endif
+	__enable_irq();
+	return 1;
+}
+#endif // USE_RUNTIME_PWM_PERIOD
+
 
 
 void Set_DAC(unsigned int code) {
@@ -316,7 +755,7 @@ void Set_DAC(unsigned int code) {
 }
 
 void Set_DAC_mA(unsigned int current) {
-	unsigned int code = MA_TO_DAC_CODE(current);
+	unsigned int code = MA_To_DAC_Code(current);
 	// Force 16-bit write to DAC
 	uint16_t * dac0dat = (uint16_t *)&(DAC0->DAT[0].DATL);
 	*dac0dat = (uint16_t) code;
@@ -340,18 +779,29 @@ void Init_DAC_HBLED(void) {
 	Set_DAC(0);
 }
 
+// Current sense: 16 bit, short sample, high speed, ADC_HW_AVG_SAMPLES averaged
+const ADC_PROFILE_T ADC_Sense_Profile = ADC_PROFILE(ADC_SENSE_CHANNEL, ADC_SENSE_MUXSEL, 3, -1, 1, ADC_HW_AVG_SAMPLES);
+
 void Init_ADC_HBLED(void) {
+	// Calibrate first: an offset error would otherwise become steady-state
+	// current error for the integrator to work off. One retry if it fails.
+	g_adc_calibrated = ADC_Calibrate() || ADC_Calibrate();
+
 	// Configure ADC to read Ch 8 (FPTB 0)
 	SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK; 
-	ADC0->CFG1 = 0x0C; // 16 bit
-	//	ADC0->CFG2 = ADC_CFG2_ADLSTS(3);
+	ADC_Apply_Profile(&ADC_Sense_Profile);
 	ADC0->SC2 = ADC_SC2_REFSEL(0);
 
 #if USE_ADC_HW_TRIGGER
 	// Enable hardware triggering of ADC
 	ADC0->SC2 |= ADC_SC2_ADTRG(1);
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	// Select triggering by control trigger timer overflow, every HW_CTL_FREQ_DIV_FACTOR PWM periods
+	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(CTL_TRIGGER_TPM_ADC_TRGSEL) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
+#else
 	// Select triggering by TPM0 Overflow
-	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(8) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
+	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(TPM0_OVERFLOW_TRGSEL) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
+#endif
 	// Select input channel 
 	ADC0->SC1[0] &= ~ADC_SC1_ADCH_MASK;
 	ADC0->SC1[0] |= ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
@@ -371,59 +821,40 @@ void Init_ADC_HBLED(void) {
 #endif // USE_ADC_INTERRUPT
 }
 
-#if 1
 void Update_Set_Current(void) {
-	// Does rectangular flash
+	// Plays the compiled waveform (waveform.h): off, then g_wave_duration ms of pulse
 	static volatile int delay = 0;
+	WAVE_SAMPLE_T s;
 	
-	if (delay == 0)					// Just for initialization from global
+	if (delay == 0) {				// start of a flash period (and initialization from global)
 		delay = g_flash_period;
-	
-	if (g_enable_flash){
-		delay--;
-		if (delay == g_flash_duration) { // turn on LED now
-			g_set_current_mA = g_peak_set_current_mA;
-			Set_DAC_mA(g_set_current_mA);
-			g_set_current_code = (g_set_current_mA<<16)/1500; 
-		} else if (delay == 0) {
-			delay = g_flash_period;
-			g_set_current_mA = 0;	// turn off LED now
-			g_set_current_code = 0; 
-			Set_DAC_mA(g_set_current_mA);
-		}
+		Wave_Update();				// new table only between pulses
 	}
-}
-#else
-void Update_Set_Current(void) {
-	// Ramp curent up and down 
-	static volatile int t = 0;
-	int phase;
-	int t_ramp;
 	
 	if (g_enable_flash){
-		t_ramp = g_flash_duration/2;
-		t++;
-		phase = (2*t)/g_flash_duration;
-		switch (phase) {
-			case 0:
-				g_set_current_mA = (t*g_peak_set_current_mA)/t_ramp;
-				break;
-			case 1:
-				g_set_current_mA = ((2*t_ramp - t)*g_peak_set_current_mA)/t_ramp;
-				break;
-			default:
-				g_set_current_mA = 0;
-				break;
+		delay--;
+#if USE_ADAPTIVE_CTL_RATE
+		if ((delay == g_wave_duration + ADAPTIVE_CTL_LEAD_MS) || (delay == ADAPTIVE_CTL_LEAD_MS)
+			|| (g_wave_varying && (delay < g_wave_duration)))
+			Control_Rate_Boost(); // setpoint changes soon
+#endif
+		if ((delay == 0) || (delay > g_wave_duration))
+			s = g_wave_off;
+		else
+			s = Wave_Sample(g_wave_duration - delay);
+		if (s.mA != g_set_current_mA) { // an edge, or a step of the waveform
+			g_set_current_mA = s.mA;
+			g_set_current_code = s.Code; 
+			Set_DAC(s.DAC);
 		}
-		Set_DAC_mA(g_set_current_mA);
-		if (t > = g_flash_period)
-			t = 0;
 	}
 }
-#endif
 
 void Init_Buck_HBLED(void) {
 	Init_DAC_HBLED();
+#if USE_DMA_SETPOINT
+	Setpoint_DMA_Init(); // Thread_Update_Setpoint starts the playback
+#endif
 	Init_ADC_HBLED();
 	
 	// Configure driver for buck converter
@@ -431,6 +862,20 @@ void Init_Buck_HBLED(void) {
 	SIM->SCGC5 |= SIM_SCGC5_PORTE_MASK;
 	PORTE->PCR[31]  &= PORT_PCR_MUX(7);
 	PORTE->PCR[31]  |= PORT_PCR_MUX(3);
+#if ENABLE_OVERCURRENT_TRIP
+	// Level Overcurrent_Trip drives when it takes the pin from TPM0: the
+	// PWM idles high (low-true pulses), so high is off
+	FPTE->PSOR = MASK(HBLED_PWM_PIN);
+	FPTE->PDDR |= MASK(HBLED_PWM_PIN);
+#endif
+	Control_Select_ISR();
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	// Arm the trigger timer before TPM0 starts, so it starts on TPM0's first overflow
+	Control_Arm_Trigger(PWM_PERIOD);
+#endif
+#if USE_SETPOINT_SHAPING
+	Shape_Init(); // profiles ready before the control ISR runs
+#endif
 	PWM_Init(TPM0, PWM_HBLED_CHANNEL, PWM_PERIOD, g_duty_cycle, 0, 0);
 }
 
@@ -439,10 +884,14 @@ void Init_Buck_HBLED(void) {
 void Control_OnOff_Handler (UI_FIELD_T * fld, int v) {
 	if (fld->Val != NULL) {
 		if (v > 0) {
+#if ENABLE_OVERCURRENT_TRIP
+			Overcurrent_Clear(); // field is g_enable_control
+#endif
 			*fld->Val = 1;
 		} else {
 			*fld->Val = 0;
 		}
+		Control_Select_ISR(); // field may be g_enable_control
 	}
 }
 
@@ -466,6 +915,16 @@ void Control_DutyCycle_Handler(UI_FIELD_T * fld, int v) {
 		else if (dc > LIM_DUTY_CYCLE)
 			dc = LIM_DUTY_CYCLE;
 		*(fld->Val) = dc;
+#if USE_DITHERED_PWM
+		PWM_Dither_Set(g_duty_cycle); // TPM0_IRQHandler writes CnV
+#endif
 		PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
 	}
 }
+
+#if USE_ADC_SAMPLE_PHASE
+// Slider moves the sampling phase by up to +/-2.5 us per update
+void Control_Sample_Phase_Handler(UI_FIELD_T * fld, int v) {
+	Control_Set_Sample_Phase(g_adc_sample_phase + v);
+}
+#endif
@@ -2,6 +2,7 @@
 #define CONTROL_H
 
 #include "FX.h"
+#include "units.h"
 #include "config.h"
 #include "UI.h"
 
@@ -25,7 +26,23 @@
 	500: 48 kHz
 	250: 96 kHz
 	*/
-#define LIM_DUTY_CYCLE (PWM_PERIOD-1)
+
+// Runtime switching frequency: Control_Set_PWM_Period picks one of
+// PWM_PERIOD_TABLE (the periods above) and rescales the duty cycle, PID gains,
+// integrator limits and learned duty tables to it. PWM_PERIOD is the period
+// at reset and the one the PID_FX_GS and Deadbeat tables were generated at;
+// selecting those modes returns to it.
+#define USE_RUNTIME_PWM_PERIOD (0)
+#define PWM_PERIOD_TABLE {800, 750, 700, 650, 600, 500, 250}
+
+#if USE_RUNTIME_PWM_PERIOD
+extern volatile int g_pwm_period;
+#define PWM_PERIOD_NOW (g_pwm_period)
+#else
+#define PWM_PERIOD_NOW (PWM_PERIOD)
+#endif
+#define LIM_DUTY_CYCLE (PWM_PERIOD_NOW-1)
+#define DEF_LIM_DUTY_CYCLE (PWM_PERIOD-1)	// for initializers
 
 // Control approach configuration
 #define USE_ASYNC_SAMPLING 				0
@@ -34,9 +51,149 @@
 #define USE_SYNC_HW_CTL_FREQ_DIV 	0
 
 #define SW_CTL_FREQ_DIV_FACTOR (3) // Software division in ISR
-#define HW_CTL_FREQ_DIV_CODE (0) // Not used, not supported
+#define HW_CTL_FREQ_DIV_FACTOR (3) // Hardware division by trigger timer
+
+/* Hardware control-frequency division (USE_SYNC_HW_CTL_FREQ_DIV):
+	CTL_TRIGGER_TPM counts up with period HW_CTL_FREQ_DIV_FACTOR PWM periods. 
+	Its counter is started by the first TPM0 overflow (CONF CSOT), so its overflow
+	stays aligned with every Nth TPM0 overflow, and it hardware-triggers ADC0. 
+	No TPM0 interrupt is needed; only the ADC completion interrupt runs.
+	TPM1 drives the LCD backlight, so TPM2 is used. */
+#define CTL_TRIGGER_TPM (TPM2)
+#define CTL_TRIGGER_TPM_ADC_TRGSEL (10) // SOPT7 ADC0TRGSEL: TPM2 overflow
+#define TPM0_OVERFLOW_TRGSEL (8) // TPM CONF TRGSEL and SOPT7 ADC0TRGSEL: TPM0 overflow
+
+#if USE_SYNC_HW_CTL_FREQ_DIV
+#define CTL_FREQ_DIV_FACTOR (HW_CTL_FREQ_DIV_FACTOR)
+#else
+#define CTL_FREQ_DIV_FACTOR (SW_CTL_FREQ_DIV_FACTOR)
+#endif
+
+#define CTL_PERIOD (PWM_PERIOD*CTL_FREQ_DIV_FACTOR)
+#define CTL_PERIOD_NOW (PWM_PERIOD_NOW*CTL_FREQ_DIV_FACTOR)
+
+/* Programmable ADC sampling phase (USE_SYNC_HW_CTL_FREQ_DIV only). The
+	trigger timer's first overflow comes g_adc_sample_phase counts (48 MHz) after
+	the TPM0 overflow that starts it, the following ones every 2*CTL_PERIOD_NOW
+	counts, so each conversion starts at that phase of the control period.
+	The middles of the on-time (2*k+1)*PWM_PERIOD and of the off-time
+	(2*k*PWM_PERIOD, the TPM0 overflows) are where the inductor current crosses
+	its mean in continuous conduction. The default samples the middle of the
+	last on-time, so the new duty cycle applies half a PWM period after the
+	sample. ADC_SAMPLE_LATENCY is the time from the trigger to the end of the
+	sample (synchronization plus 4 ADCK sampling cycles, 16-bit mode with the
+	24 MHz bus clock). Control_Set_Sample_Phase changes the phase at run time
+	(UI "Ph" field). Only TPM1 channel compares can trigger the ADC directly,
+	and TPM1 CH0 drives the LCD backlight: the phase is set by the trigger
+	timer's first overflow instead. */
+#define USE_ADC_SAMPLE_PHASE (0)
+#define ADC_SAMPLE_LATENCY (20)
+#define ADC_SAMPLE_PHASE_DEF (2*CTL_PERIOD - PWM_PERIOD - ADC_SAMPLE_LATENCY)
+
+#if USE_ADC_SAMPLE_PHASE
+#if !USE_SYNC_HW_CTL_FREQ_DIV
+#error "USE_ADC_SAMPLE_PHASE needs the trigger timer (USE_SYNC_HW_CTL_FREQ_DIV)"
+#endif
+extern volatile int g_adc_sample_phase;
+#endif
+
+// Adaptive control rate (USE_SYNC_SW_CTL_FREQ_DIV only). TPM0_IRQHandler asks
+// Control_Rate_Tick every PWM period whether to start a control update:
+// - every ADAPTIVE_CTL_FAST_DIV_FACTOR periods for ADAPTIVE_CTL_FAST_WINDOW_MS after
+//   Control_Rate_Boost, which Update_Set_Current calls ADAPTIVE_CTL_LEAD_MS before
+//   each setpoint change, and while the scope is capturing (uniform time base)
+// - every ADAPTIVE_CTL_SLOW_DIV_FACTOR periods once |error| <= ADAPTIVE_CTL_STABLE_ERR_mA
+// - every SW_CTL_FREQ_DIV_FACTOR periods otherwise
+// PID_FX and PID_FX_GS outputs are scaled to the PWM periods since the last
+// update; the other modes' gains are per update.
+#define USE_ADAPTIVE_CTL_RATE (0)
+#define ADAPTIVE_CTL_FAST_DIV_FACTOR (1)
+#define ADAPTIVE_CTL_SLOW_DIV_FACTOR (16)
+#define ADAPTIVE_CTL_LEAD_MS (1)
+#define ADAPTIVE_CTL_FAST_WINDOW_MS (4)
+#define ADAPTIVE_CTL_STABLE_ERR_mA (3)
+#define PWM_PERIODS_PER_MS (24000/PWM_PERIOD_NOW) // 48 MHz, up/down counting
+#define ADAPTIVE_CTL_FAST_WINDOW (ADAPTIVE_CTL_FAST_WINDOW_MS*PWM_PERIODS_PER_MS)
+
+#if USE_ADAPTIVE_CTL_RATE && !USE_SYNC_SW_CTL_FREQ_DIV
+#error "USE_ADAPTIVE_CTL_RATE needs the software divider (USE_SYNC_SW_CTL_FREQ_DIV)"
+#endif
 
-#define CTL_PERIOD (PWM_PERIOD*SW_CTL_FREQ_DIV_FACTOR)
+// Duty-cycle feedforward learned at startup (feedforward.h): on a setpoint
+// step PID_FX and PID_FX_GS jump to the learned duty cycle for the new current.
+#define USE_DUTY_FEEDFORWARD (0)
+
+// Relay-feedback PID_FX autotuner (autotune.h), started from the UI "Tune"
+// field. Tuned gains are saved in flash (nvm.h) and loaded at startup.
+#define USE_AUTOTUNE (0)
+
+// Latency compensation: PID_FX and PID_FX_GS act on the current predicted
+// for the next PWM reload, when the new duty cycle applies (predictor.h),
+// rather than on the sample taken before the previous one finished.
+#define USE_CURRENT_PREDICTOR (0)
+
+// Setpoint shaping (setpoint_shape.h): overdrive, S-curve ramp or inverse
+// closed-loop profile applied to each setpoint step for the control modes.
+// The UI "Rise" field selects the profile and shows its rise time.
+#define USE_SETPOINT_SHAPING (0)
+
+// Sigma-delta dithered PWM (pwm_dither.h): PID_FX and PID_FX_GS keep a
+// fractional duty cycle, spread over successive PWM periods. Needs a
+// modulator step every PWM period, from the control ISR or TPM0_IRQHandler.
+#define USE_DITHERED_PWM (0)
+#if USE_DITHERED_PWM && !(USE_SYNC_SW_CTL_FREQ_DIV || USE_SYNC_NO_FREQ_DIV)
+#error "USE_DITHERED_PWM needs a CPU interrupt every PWM period (USE_SYNC_SW_CTL_FREQ_DIV or USE_SYNC_NO_FREQ_DIV)"
+#endif
+
+// Current-sense oversampling (adc_decim.h). ADC_HW_AVG_SAMPLES (1: off, 4, 8,
+// 16, 32) conversions are averaged by the ADC into each result. With
+// USE_ADC_OVERSAMPLING (software divider only) the PWM periods between
+// control updates convert too, and the control ISR gets the mean of the
+// SW_CTL_FREQ_DIV_FACTOR results of its control period.
+#define USE_ADC_OVERSAMPLING (0)
+#define ADC_HW_AVG_SAMPLES (1)
+
+// Conversion time (KL25 RM 28.4.4.5): 16-bit single-ended, short sample,
+// ADHSC, ADCK = bus/2 = 12 MHz as set by Init_ADC:
+// 5 ADCK + 5 bus cycles + avg*(25 + 2) ADCK.
+//   avg 1: 2.9 us, 4: 9.6 us, 8: 18.6 us, 16: 36.6 us, 32: 72.6 us
+#define ADC_CONV_ADCK(avg) (5 + (avg)*27)
+#define ADC_CONV_TIME_NS(avg) ((ADC_CONV_ADCK(avg)*1000)/12 + (5*1000)/24)
+#define PWM_PERIOD_NS ((2*PWM_PERIOD*1000)/48)
+
+#if USE_ADC_OVERSAMPLING
+#if !USE_SYNC_SW_CTL_FREQ_DIV || USE_ADAPTIVE_CTL_RATE
+#error "USE_ADC_OVERSAMPLING needs the fixed software divider (USE_SYNC_SW_CTL_FREQ_DIV without USE_ADAPTIVE_CTL_RATE)"
+#endif
+#if ADC_CONV_TIME_NS(ADC_HW_AVG_SAMPLES) >= PWM_PERIOD_NS
+#error "With USE_ADC_OVERSAMPLING each conversion must finish within one PWM period: reduce ADC_HW_AVG_SAMPLES"
+#endif
+#endif
+#if ADC_CONV_TIME_NS(ADC_HW_AVG_SAMPLES) >= CTL_PERIOD*2*1000/48
+#error "ADC_HW_AVG_SAMPLES conversions do not fit in a control period"
+#endif
+
+// DMA setpoint playback (setpoint_dma.h): the flash is compiled into runs of
+// DAC codes that DMA writes on PIT-timed edges, instead of
+// Thread_Update_Setpoint counting down every ms. The control ISR reads the
+// setpoint of the run being played from the DMA.
+#define USE_DMA_SETPOINT (0)
+
+#if USE_DMA_SETPOINT && USE_ADAPTIVE_CTL_RATE
+#error "USE_ADAPTIVE_CTL_RATE boosts the control rate from Update_Set_Current, which USE_DMA_SETPOINT replaces"
+#endif
+
+#if USE_RUNTIME_PWM_PERIOD && USE_CURRENT_PREDICTOR
+#error "The current predictor was identified at PWM_PERIOD; it cannot follow USE_RUNTIME_PWM_PERIOD"
+#endif
+
+// Specialized control ISR: build one Control_HBLED body per CTL_MODE_E with the
+// mode and enable tests folded away, and select it through a function pointer
+// when the mode changes (Control_Set_Mode, Control_Select_ISR).
+// 0: generic Control_HBLED dispatches on control_mode every sample.
+#ifndef USE_SPECIALIZED_CONTROL_ISR
+#define USE_SPECIALIZED_CONTROL_ISR (0)
+#endif
 
 #if USE_ASYNC_SAMPLING
 #define 	USE_TPM0_INTERRUPT 0
@@ -63,24 +220,28 @@
 #endif
 
 // Control Parameters
-// default control mode: OpenLoop, BangBang, Incremental, PID, PID_FX
+// default control mode: OpenLoop, BangBang, Incremental, PID, PID_FX, PID_FX_GS, ILC, Deadbeat
+// (Autotune is entered through Autotune_Start)
 #define DEF_CONTROL_MODE (PID_FX)
 
-// Incremental controller: change amount
-#define INC_STEP (0.1*CTL_PERIOD)
+// Incremental controller: change amount, duty counts
+#define INC_STEP (CTL_PERIOD/10)
 
-// Proportional Gain, scaled by 2^8
-#define PGAIN_8 (1.0*CTL_PERIOD) // (0x0028)
+// Proportional Gain, scaled by 2^8 (DUTY_GAIN_T)
+#define PGAIN_8 (CTL_PERIOD) // (0x0028)
 
-// PID (floating-point) gains. Guaranteed to be non-optimal. 
+// PID gains in duty counts per mA, stored as DUTY_GAIN_T. Guaranteed to be non-optimal. 
 #define P_GAIN_FL (0.006*CTL_PERIOD)
 #define I_GAIN_FL (0.000*CTL_PERIOD)
 #define D_GAIN_FL (0.000*CTL_PERIOD)
 
 // PID_FX (fixed-point) gains. Guaranteed to be non-optimal. 
-#define P_GAIN_FX (87.5*CTL_PERIOD)	
-#define I_GAIN_FX (0.625*CTL_PERIOD) 
-#define D_GAIN_FX (0.0*CTL_PERIOD)
+#define P_GAIN_FX ((FX16_16) (87.5*CTL_PERIOD))
+#define I_GAIN_FX ((FX16_16) (0.625*CTL_PERIOD))
+#define D_GAIN_FX ((FX16_16) (0.0*CTL_PERIOD))
+
+//=============================================================
+// PID_FX_GS (gain-scheduled fixed-point) gains: see gain_sched.h
 
 //=============================================================
 // PID Gain Validation Limits (for fault protection)
@@ -94,16 +255,16 @@
 #define I_GAIN_FX_MIN  (0)
 #define I_GAIN_FX_MAX  (10 * I_GAIN_FX + 10000)  // Allow some range even if default is 0
 
-// Valid range for D gain: 0 to 10x default (or small positive if default is 0)
+// Valid range for D gain: 0 to 10x default (or the autotuner's range if default is 0)
 #define D_GAIN_FX_MIN  (0)
-#define D_GAIN_FX_MAX  (10 * D_GAIN_FX + 10000)  // Allow some range even if default is 0
+#define D_GAIN_FX_MAX  (10 * D_GAIN_FX + FL_TO_FX(8.0))  // Autotune puts Kp here
 
 // Data type definitions
 typedef struct {
-	float dState; // Last position input
-	float iState; // Integrator state
-	float iMax, iMin; // Maximum and minimum allowable integrator state
-	float pGain, // proportional gain
+	MA_T dState; // Last position input
+	int32_t iState; // Integrator state, mA
+	int32_t iMax, iMin; // Maximum and minimum allowable integrator state
+	DUTY_GAIN_T pGain, // proportional gain
 				iGain, // integral gain
 				dGain; // derivative gain
 } SPid;
@@ -117,7 +278,7 @@ typedef struct {
 				dGain; // derivative gain
 } SPidFX;
 
-typedef enum {OpenLoop, BangBang, Incremental, Proportional, PID, PID_FX, MODE_COUNT} CTL_MODE_E;
+typedef enum {OpenLoop, BangBang, Incremental, Proportional, PID, PID_FX, PID_FX_GS, ILC, Deadbeat, Autotune, MODE_COUNT} CTL_MODE_E;
 
 // Scope state machine states for ISR-Thread synchronization
 // Armed:     Waiting for trigger (setpoint crosses threshold)
@@ -126,6 +287,14 @@ typedef enum {OpenLoop, BangBang, Incremental, Proportional, PID, PID_FX, MODE_C
 // Plotting:  TDW is plotting data, ISR must not write to buffers
 typedef enum {Armed, Triggered, Full, Plotting} SCOPE_STATE_E;
 
+// Scope capture state, saved around code that runs the control ISR body
+// outside the flash sequence (Bench_Run_On_Target)
+typedef struct {
+	SCOPE_STATE_E State;
+	int Sample_Idx;
+	int Prev_Set_mA;
+} SCOPE_CONTEXT_T;
+
 //=============================================================
 // RTOS Event Flags for Scope Synchronization (Approach 2)
 // Used when SCOPE_SYNC_WITH_RTOS == 1
@@ -144,6 +313,19 @@ extern osEventFlagsId_t scope_event_flags;
 // Functions
 void Init_Buck_HBLED(void);
 void Update_Set_Current(void);
+void Set_DAC(unsigned int code);
+void Set_DAC_mA(unsigned int current);
+
+#if USE_ADAPTIVE_CTL_RATE
+int Control_Rate_Tick(void);
+void Control_Rate_Boost(void);
+extern volatile uint32_t g_ctl_updates_run;			// control updates started
+extern volatile uint32_t g_ctl_updates_skipped;	// PWM periods without a control update
+#endif
+
+// Controller kernels (also used by bench.c)
+DUTY_T UpdatePID(SPid * pid, MA_T error, MA_T position);
+FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX);
 
 // Fault protection: PID gain validation
 // Call periodically to detect and correct corrupted PID gains
@@ -153,9 +335,13 @@ void Validate_PID_Gains(void);
 void Control_OnOff_Handler (UI_FIELD_T * fld, int v);
 void Control_IntNonNegative_Handler (UI_FIELD_T * fld, int v);
 void Control_DutyCycle_Handler(UI_FIELD_T * fld, int v);
+#if USE_ADC_SAMPLE_PHASE
+void Control_Sample_Phase_Handler(UI_FIELD_T * fld, int v);
+#endif
 
 // Shared global variables
 extern volatile int g_set_current_mA; // Default starting LED current
+extern volatile int g_set_current_code; // g_set_current_mA as an ADC code, for the scope
 extern volatile uint16_t g_set_current_sample;
 extern volatile int g_peak_set_current_mA;
 extern volatile int g_flash_duration;
@@ -183,26 +369,30 @@ extern SPid plantPID;
 #define ADC_SENSE_CHANNEL (8)
 #define ADC_SENSE_MUXSEL (0)
 
-
-#define R_SENSE (2.2f)
-#define R_SENSE_MO ((int) (R_SENSE*1000))
-
-#define V_REF (3.3f)
-#define V_REF_MV ((int) (V_REF*1000))
-
-#define ADC_FULL_SCALE (0x10000)
-#define MA_SCALING_FACTOR (1000)
-
+// R_SENSE, V_REF and the ADC and DAC scaling: see units.h
 
 #ifndef DAC_POS
 	#define DAC_POS 30
 #endif
 
-#define DAC_RESOLUTION 4096
-
-#define MA_TO_DAC_CODE(i) ((i)*(2.2f*DAC_RESOLUTION/V_REF_MV))
-// #define MA_TO_DAC_CODE(i) (i*2.2*DAC_RESOLUTION/V_REF_MV) // Introduces timing delay and interesting bug!
-
 void Control_HBLED(void);
+void Control_Set_Mode(CTL_MODE_E m);
+#if USE_RUNTIME_PWM_PERIOD
+int Control_Set_PWM_Period(int period);
+#endif
+#if USE_ADC_SAMPLE_PHASE
+void Control_Set_Sample_Phase(int counts);
+#endif
+void Control_Select_ISR(void);
+void Control_Scope_Save(SCOPE_CONTEXT_T * c);
+void Control_Scope_Restore(const SCOPE_CONTEXT_T * c);
+
+// Control ISR entry point used by the ADC and TPM handlers
+#if USE_SPECIALIZED_CONTROL_ISR
+extern void (* volatile Control_HBLED_Fn)(void);
+#define CONTROL_HBLED() ((*Control_HBLED_Fn)())
+#else
+#define CONTROL_HBLED() Control_HBLED()
+#endif
 
 #endif // #ifndef CONTROL_H
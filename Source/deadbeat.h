@@ -0,0 +1,76 @@
+#ifndef DEADBEAT_H
+#define DEADBEAT_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "FX.h"
+#include "control.h"
+
+/* Deadbeat current control with an explicit constrained law (control mode
+ * Deadbeat). Around each operating point the sampled plant is modeled as
+ *   i[k+1] = a*i[k] + b1*u[k-1] + b2*u[k] + c
+ * where u[k] is the duty cycle written at sample k. It takes effect at the
+ * next PWM reload, so u[k-1] still drives the first PWM period of the next
+ * control period. Solving for i[k+1] = set gives the affine law
+ *   u[k] = C0 + CSet*set + CMeas*i[k] + CPrev*u[k-1]
+ * with C0 = -c/b2, CSet = 1/b2, CMeas = -a/b2, CPrev = -b1/b2.
+ *
+ * With one input and this one-step horizon, the explicit MPC solution has
+ * three critical regions per operating point: the affine law where it lies
+ * within [0, LIM_DUTY_CYCLE], and each duty cycle bound where it does not.
+ * The ISR evaluates the region inequalities on the affine value and outputs
+ * the region's law, so a bound is a region of the law, not a later clamp.
+ * The law's own state u[k-1] is the duty cycle actually applied, so a
+ * saturated edge is followed by the duty cycle that lands on the setpoint.
+ *
+ * The model holds while the LED conducts. From zero current (measured at
+ * most DEADBEAT_OFF_mA, e.g. at the flash's rising edge) a fourth region
+ * applies u[k] = COff + CSet*set: COff is fitted so that one control period
+ * from rest reaches the operating current.
+ *
+ * The model identification and all the algebra run on the host:
+ * make -C Simulator deadbeat-table regenerates deadbeat_table.c.
+ * The ISR work is a table lookup, up to three multiplies and adds, and
+ * three compares.
+ */
+
+#define DEADBEAT_SHIFT (4)
+#define DEADBEAT_STEP_mA (1<<DEADBEAT_SHIFT)
+#define DEADBEAT_ENTRIES (17) // operating points at 0, 16, ... 256 mA
+#define DEADBEAT_MAX_mA ((DEADBEAT_ENTRIES-1)*DEADBEAT_STEP_mA)
+#define DEADBEAT_OFF_mA (2)
+
+typedef struct {
+	FX16_16 C0, CSet, CMeas, CPrev, COff;
+} DEADBEAT_ENTRY_T;
+
+// Generated table. The model depends on the control period, so the table
+// refuses to build if CTL_PERIOD differs from the characterization run.
+extern const DEADBEAT_ENTRY_T Deadbeat_Table[DEADBEAT_ENTRIES];
+
+// Duty cycle for set_mA given the measured current and the last duty cycle
+__STATIC_FORCEINLINE int Deadbeat_Update(int set_mA, int measured_mA, int prev_duty) {
+	const DEADBEAT_ENTRY_T * e;
+	int k;
+	FX16_16 u;
+
+	if (set_mA <= 0)
+		return 0; // LED off
+	k = (set_mA + DEADBEAT_STEP_mA/2) >> DEADBEAT_SHIFT; // nearest operating point
+	if (k == 0)
+		k = 1;
+	else if (k >= DEADBEAT_ENTRIES)
+		k = DEADBEAT_ENTRIES-1;
+	e = &Deadbeat_Table[k];
+	if (measured_mA <= DEADBEAT_OFF_mA)
+		u = e->COff + e->CSet*set_mA;	// region: LED starting from rest
+	else
+		u = e->C0 + e->CSet*set_mA + e->CMeas*measured_mA + e->CPrev*prev_duty;
+	if (u >= INT_TO_FX(LIM_DUTY_CYCLE))
+		return LIM_DUTY_CYCLE;	// region: upper bound active
+	if (u <= 0)
+		return 0;								// region: lower bound active
+	return FX_TO_INT(u);			// region: unconstrained
+}
+
+#endif // DEADBEAT_H
@@ -0,0 +1,33 @@
+// Generated by Simulator/hbled_sim -M (make -C Simulator deadbeat-table). Do not edit.
+// Plant: VIn 5.00 V, L 1000 uH, LED 2.70 V + 3.00 ohm, RSense 2.20 ohm
+#include "deadbeat.h"
+#include "predictor.h"
+
+#define DEADBEAT_TABLE_CTL_PERIOD (2250)
+#if DEADBEAT_TABLE_CTL_PERIOD != CTL_PERIOD
+#error "Deadbeat_Table was characterized at another CTL_PERIOD; regenerate it"
+#endif
+
+const DEADBEAT_ENTRY_T Deadbeat_Table[DEADBEAT_ENTRIES] = {
+	// C0, CSet, CMeas, CPrev, COff
+	{0, 0, 0, 0, 0}, //   0 mA
+	{26865838, 224395, -100529, -767, 25245513}, //  16 mA
+	{39052742, 176458, -101632, -25273, 26531506}, //  32 mA
+	{39048349, 175871, -102937, -25114, 26947645}, //  48 mA
+	{39005044, 175675, -102823, -25017, 27357532}, //  64 mA
+	{38925768, 175317, -102597, -24839, 27786604}, //  80 mA
+	{39046191, 175761, -102877, -25111, 28084619}, //  96 mA
+	{39048267, 175775, -102943, -25106, 27957825}, // 112 mA
+	{39081971, 175727, -102708, -25217, 26593398}, // 128 mA
+	{38954833, 175360, -102551, -24930, 23834667}, // 144 mA
+	{39112985, 175925, -102887, -25284, 20938436}, // 160 mA
+	{38970163, 175458, -102790, -24925, 18205792}, // 176 mA
+	{39024947, 175548, -102691, -25082, 15381254}, // 192 mA
+	{38984747, 175552, -102748, -24999, 12571739}, // 208 mA
+	{39057789, 175353, -102437, -25163, 9807423}, // 224 mA
+	{39027772, 175554, -102716, -25089, 6953496}, // 240 mA
+	{39054500, 175567, -102652, -25165, 4141214}, // 256 mA
+};
+
+// One PWM period at the 80 mA operating point, nearest FLASH_CURRENT_MA
+const CURRENT_PREDICTOR_T Current_Predictor = {54817, 13271, -5737590}; // Alpha, Beta, Gamma
@@ -68,15 +68,29 @@ int Overflow_Stack(void) {
 	return 0;
 }
 
+// Enough distinct requests to fill the queue and every pending slot, so
+// none is resubmitted before the ADC server completes it
+#define FAULT_FILL_REQUESTS (ADC_QUEUE_LEN + ADC_PENDING_MAX + 1)
+
 void Fault_Fill_Queue(void ) {
-	ADC_Request_t req;
-	osStatus_t status;
+	static ADC_Request_t req[FAULT_FILL_REQUESTS];
+	uint8_t channel = 0;
+	int i;
 
-	req.Channel = 0;
-	req.ResponseQueue = (osMessageQueueId_t) NULL;
+	for (i = 0; i < FAULT_FILL_REQUESTS; i++) {
+		req[i].Count = 1;
+		req[i].Deadline = 0;
+		req[i].Done = 1;
+	}
+	i = 0;
 	do {
-		req.Channel++;
-		status = osMessageQueuePut(ADC_RequestQueue, &req, 0, 0);
+		if (req[i].Done) { // blocks while the queue is full
+			req[i].Conv[0].Channel = ++channel;
+			req[i].Conv[0].MuxSel = 0;
+			ADC_Submit(&req[i]);
+		}
+		if (++i >= FAULT_FILL_REQUESTS)
+			i = 0;
 	} while (1);
 }
 
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "control.h"
+#include "feedforward.h"
+
+#ifndef SIM_HOST
+#include <MKL25Z4.h>
+#include "LCD.h"
+#include "colors.h"
+#include "delay.h"
+#if ENABLE_COP_WATCHDOG
+#include "wdt.h"
+#endif
+#endif
+
+volatile uint16_t g_ff_duty_table[FF_ENTRIES]; // global to give debugger access
+volatile int g_ff_valid = 0;
+volatile int g_ff_learn_ms = 0;
+volatile int g_ff_duty = 0;
+
+// Sweep state, owned by the control ISR while learning
+static volatile int ff_learning = 0;
+static CTL_MODE_E ff_saved_mode;
+static int ff_duty, ff_count, ff_sum, ff_samples;
+static int ff_prev_duty, ff_prev_mA, ff_next;
+
+// Start the sweep. Call with the LED setpoint at 0 (before the RTOS starts);
+// the control ISR runs it and restores the control mode when done.
+void FF_Learn_Start(void) {
+	ff_saved_mode = control_mode;
+	ff_duty = 0;
+	ff_count = ff_sum = ff_samples = 0;
+	ff_prev_duty = ff_prev_mA = 0;
+	ff_next = 0;
+	g_ff_valid = 0;
+	g_duty_cycle = 0;
+	g_enable_control = 1;
+	ff_learning = 1;
+	Control_Set_Mode(OpenLoop);
+}
+
+int FF_Learning(void) {
+	return ff_learning;
+}
+
+static void FF_Learn_Finish(void) {
+	while (ff_next < FF_ENTRIES) // currents above the sweep's reach
+		g_ff_duty_table[ff_next++] = ff_prev_duty;
+	g_ff_learn_ms = (ff_samples*CTL_PERIOD_NOW)/24000; // CTL_PERIOD_NOW counts at 24 MHz
+	g_duty_cycle = 0;
+	g_ff_valid = 1;
+	ff_learning = 0;
+	Control_Set_Mode(ff_saved_mode);
+}
+
+void FF_Learn_Step(int measured_mA) {
+	int mA, c;
+
+	if (!ff_learning)
+		return;
+	ff_samples++;
+	if (++ff_count <= FF_SETTLE_SAMPLES)
+		return; // let the current settle at this duty cycle
+	ff_sum += measured_mA;
+	if (ff_count < FF_SETTLE_SAMPLES + FF_AVG_SAMPLES)
+		return;
+	mA = ff_sum/FF_AVG_SAMPLES;
+
+	// Interpolate the duty cycle of each breakpoint passed since the last point
+	while ((ff_next < FF_ENTRIES) && (mA >= (ff_next << FF_SHIFT))) {
+		c = ff_next << FF_SHIFT;
+		if (mA > ff_prev_mA)
+			g_ff_duty_table[ff_next] = ff_prev_duty + ((ff_duty - ff_prev_duty)*(c - ff_prev_mA))/(mA - ff_prev_mA);
+		else
+			g_ff_duty_table[ff_next] = ff_duty;
+		ff_next++;
+	}
+	if (mA > ff_prev_mA) { // keep the table monotonic despite noise
+		ff_prev_mA = mA;
+		ff_prev_duty = ff_duty;
+	}
+
+	ff_duty += FF_SWEEP_STEP;
+	ff_count = ff_sum = 0;
+	if ((ff_next >= FF_ENTRIES) || (ff_duty > LIM_DUTY_CYCLE))
+		FF_Learn_Finish();
+	else
+		g_duty_cycle = ff_duty;
+}
+
+#ifndef SIM_HOST
+// Show the learned table on the LCD for a few seconds (before the RTOS starts)
+void FF_Show_Table(void) {
+	char buf[32];
+	int k, i;
+
+	// Small font: 26 columns, three table entries per row
+	LCD_Text_Init(0);
+	LCD_Text_Set_Colors(&white, &black);
+	snprintf(buf, sizeof(buf), "FF sweep %d ms", g_ff_learn_ms);
+	LCD_Text_PrintStr_RC(0, 0, buf);
+	LCD_Text_PrintStr_RC(1, 0, "mA duty  mA duty  mA duty");
+	for (k = 0; k < FF_ENTRIES; k++) {
+		snprintf(buf, sizeof(buf), "%3d %3d", k*FF_STEP_mA, g_ff_duty_table[k]);
+		LCD_Text_PrintStr_RC(2 + k/3, 9*(k%3), buf);
+	}
+	for (i = 0; i < 60; i++) { // leave table up for about 3 s
+		Delay(50);
+#if ENABLE_COP_WATCHDOG
+		WDT_Feed();
+#endif
+	}
+	LCD_Text_Init(1);
+}
+#endif // SIM_HOST
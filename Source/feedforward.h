@@ -0,0 +1,53 @@
+#ifndef FEEDFORWARD_H
+#define FEEDFORWARD_H
+
+#include <stdint.h>
+#include "config.h"
+#include "control.h"
+
+/* Duty-cycle feedforward (USE_DUTY_FEEDFORWARD in control.h).
+ * At startup FF_Learn_Start sweeps the duty cycle in OpenLoop mode and
+ * records the steady measured current at each step. The control ISR runs
+ * the sweep (FF_Learn_Step), so it is timed in control periods and needs no
+ * delay loop. The sweep is inverted into g_ff_duty_table: the duty cycle
+ * giving each current from 0 to FF_MAX_mA in FF_STEP_mA steps.
+ * When g_set_current_mA steps, PID_FX and PID_FX_GS jump to the table's
+ * duty cycle and clear the integrator, leaving the PID to correct only
+ * the residual error.
+ */
+
+#define FF_SHIFT (3)
+#define FF_STEP_mA (1<<FF_SHIFT)
+#define FF_ENTRIES (33) // 0, 8, ... 256 mA
+#define FF_MAX_mA ((FF_ENTRIES-1)*FF_STEP_mA)
+
+#define FF_SWEEP_STEP (8)					// duty cycle counts per sweep point
+#define FF_SETTLE_SAMPLES (8)			// control periods to settle at each point
+#define FF_AVG_SAMPLES (8)				// control periods averaged at each point
+
+extern volatile uint16_t g_ff_duty_table[FF_ENTRIES];
+extern volatile int g_ff_valid;			// table has been learned
+extern volatile int g_ff_learn_ms;	// sweep duration
+extern volatile int g_ff_duty;			// last feedforward duty cycle applied
+
+void FF_Learn_Start(void);
+void FF_Learn_Step(int measured_mA); // called by the control ISR in OpenLoop mode
+int FF_Learning(void);
+#ifndef SIM_HOST
+void FF_Show_Table(void);
+#endif
+
+// Feedforward duty cycle for set_mA, interpolated between table entries
+static inline int FF_Duty(int set_mA) {
+	int k, f;
+
+	if (set_mA <= 0)
+		return 0;
+	if (set_mA >= FF_MAX_mA)
+		return g_ff_duty_table[FF_ENTRIES-1];
+	k = set_mA >> FF_SHIFT;
+	f = set_mA & (FF_STEP_mA-1);
+	return g_ff_duty_table[k] + (((g_ff_duty_table[k+1] - g_ff_duty_table[k])*f) >> FF_SHIFT);
+}
+
+#endif // FEEDFORWARD_H
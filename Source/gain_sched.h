@@ -0,0 +1,48 @@
+#ifndef GAIN_SCHED_H
+#define GAIN_SCHED_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "FX.h"
+#include "control.h"
+
+/* Gain-scheduled PID_FX (control mode PID_FX_GS).
+ * P/I/D gains come from Gain_Sched_Table, indexed by the set current in
+ * steps of GAIN_SCHED_STEP_mA and linearly interpolated between entries.
+ * The lookup is a shift, a mask and three multiplies, with no loop.
+ * gain_sched_table.c is generated on the host from a characterization run
+ * of the plant simulator: make -C Simulator gain-table
+ */
+
+#define GAIN_SCHED_SHIFT (4)
+#define GAIN_SCHED_STEP_mA (1<<GAIN_SCHED_SHIFT)
+#define GAIN_SCHED_ENTRIES (17) // breakpoints at 0, 16, ... 256 mA
+#define GAIN_SCHED_MAX_mA ((GAIN_SCHED_ENTRIES-1)*GAIN_SCHED_STEP_mA)
+
+typedef struct {
+	FX16_16 pGain, iGain, dGain;
+} GAIN_SCHED_ENTRY_T;
+
+// Generated table. Gains scale with the control period, so the table
+// refuses to build if CTL_PERIOD differs from the characterization run.
+extern const GAIN_SCHED_ENTRY_T Gain_Sched_Table[GAIN_SCHED_ENTRIES];
+
+extern SPidFX plantPID_FX_GS;
+
+// Load pid's gains for set current set_mA (clamped to the table's range)
+__STATIC_FORCEINLINE void Gain_Sched_Update(SPidFX * pid, int set_mA) {
+	const GAIN_SCHED_ENTRY_T * e;
+	FX1_15 w;
+
+	if (set_mA < 0)
+		set_mA = 0;
+	else if (set_mA >= GAIN_SCHED_MAX_mA)
+		set_mA = GAIN_SCHED_MAX_mA - 1;
+	e = &Gain_Sched_Table[set_mA >> GAIN_SCHED_SHIFT];
+	w = (FX1_15)((set_mA & (GAIN_SCHED_STEP_mA-1)) << (15-GAIN_SCHED_SHIFT));
+	pid->pGain = e[0].pGain + Multiply_FX1_15_FX(w, e[1].pGain - e[0].pGain);
+	pid->iGain = e[0].iGain + Multiply_FX1_15_FX(w, e[1].iGain - e[0].iGain);
+	pid->dGain = e[0].dGain + Multiply_FX1_15_FX(w, e[1].dGain - e[0].dGain);
+}
+
+#endif // GAIN_SCHED_H
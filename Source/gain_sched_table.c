@@ -0,0 +1,29 @@
+// Generated by Simulator/hbled_sim -G (make -C Simulator gain-table). Do not edit.
+// Plant: VIn 5.00 V, L 1000 uH, LED 2.70 V + 3.00 ohm, RSense 2.20 ohm
+#include "gain_sched.h"
+
+#define GAIN_SCHED_TABLE_CTL_PERIOD (2250)
+#if GAIN_SCHED_TABLE_CTL_PERIOD != CTL_PERIOD
+#error "Gain_Sched_Table was characterized at another CTL_PERIOD; regenerate it"
+#endif
+
+const GAIN_SCHED_ENTRY_T Gain_Sched_Table[GAIN_SCHED_ENTRIES] = {
+	// pGain, iGain, dGain
+	{393750, 351, 0}, //   0 mA
+	{277593, 351, 0}, //  16 mA
+	{196875, 351, 0}, //  32 mA
+	{139781, 351, 0}, //  48 mA
+	{98437, 351, 0}, //  64 mA
+	{68906, 351, 0}, //  80 mA
+	{68906, 492, 0}, //  96 mA
+	{68906, 351, 0}, // 112 mA
+	{98437, 351, 0}, // 128 mA
+	{68906, 351, 0}, // 144 mA
+	{68906, 351, 0}, // 160 mA
+	{49218, 351, 0}, // 176 mA
+	{68906, 351, 0}, // 192 mA
+	{98437, 492, 0}, // 208 mA
+	{98437, 492, 0}, // 224 mA
+	{98437, 703, 0}, // 240 mA
+	{98437, 703, 0}, // 256 mA
+};
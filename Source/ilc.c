@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "control.h"
+#include "ilc.h"
+
+volatile int16_t g_ilc_duty[ILC_SAMPLES];		// learned duty cycle trajectory, global to give debugger access
+volatile int8_t g_ilc_error[ILC_SAMPLES];		// tracking error of the last pulse, mA
+volatile int g_ilc_pos = -1;
+#if USE_ADAPTIVE_CTL_RATE || USE_RUNTIME_PWM_PERIOD
+volatile int g_ilc_step = ILC_STEP_OF(CTL_FREQ_DIV_FACTOR, PWM_PERIOD);
+#endif
+#if USE_RUNTIME_PWM_PERIOD
+volatile int g_ilc_gain = ILC_LEARN_GAIN << ILC_GAIN_BITS;
+#endif
+
+// Restart learning from a flat trajectory at duty, e.g. the feedforward
+// duty cycle for the flash current. From 0 the first few pulses are spent
+// learning the duty cycle where the LED starts to conduct.
+void ILC_Reset(int duty) {
+	int n;
+
+	for (n = 0; n < ILC_SAMPLES; n++)
+		g_ilc_duty[n] = duty << ILC_FRAC_BITS;
+	memset((void *) g_ilc_error, 0, sizeof(g_ilc_error));
+	g_ilc_pos = -1;
+}
@@ -0,0 +1,124 @@
+#ifndef ILC_H
+#define ILC_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+
+/* Iterative learning control (control mode ILC).
+ * The flash pulse from Update_Set_Current repeats every g_flash_period, so
+ * the duty-cycle trajectory that tracks it can be learned instead of
+ * computed by feedback. For each sample n of the pulse (CTL_PERIOD at
+ * PWM_PERIOD, 93.75 us, since the setpoint's rising edge), ILC keeps the
+ * duty cycle g_ilc_duty[n] and the tracking error g_ilc_error[n] it produced,
+ * measured at the next control update. On entering sample n the ISR refines
+ * the trajectory with the last pulse's errors, then applies it:
+ *   g_ilc_duty[n] = Q(g_ilc_duty)[n] + ILC_LEARN_GAIN * Q(g_ilc_error)[n+1]
+ * Q is the [1 2 1]/4 filter over neighbouring samples. It keeps the edge
+ * samples, whose error the duty cycle cannot remove within one sample,
+ * from integrating into a growing overshoot. The error one sample ahead
+ * (lead) accounts for the inductor: a duty cycle step shows mostly in the
+ * following sample. Below the LED's forward voltage the current and the
+ * plant gain are zero, so where the last pulse measured no current the
+ * step is ILC_DEADZONE_GAIN times larger, but at most 1/2^ILC_DEADZONE_SHIFT
+ * of the way to LIM_DUTY_CYCLE. Samples past ILC_SAMPLES reuse the last
+ * entry, which then integrates its own error every update. The LED is off
+ * between pulses. RAM: ILC_SAMPLES*3 bytes.
+ *
+ * Simulator, 75 mA from ILC_Reset(0): error -14 mA at pulse 4, +2..+4 mA
+ * (the ADC sample vs. the ripple average) and 11-13 % overshoot from
+ * pulse 6 on. A gain of 1 count/mA or more over-corrects: the plant
+ * gives about 1.3 mA per count.
+ *
+ * The position in the pulse advances by the length of each control
+ * period, so the table stays indexed by time when the control rate
+ * (USE_ADAPTIVE_CTL_RATE) or the PWM period (USE_RUNTIME_PWM_PERIOD)
+ * changes. A sample spanning several updates is learned once, on entry.
+ */
+
+#define ILC_SAMPLES (128)		// 12 ms of pulse at 93.75 us per sample
+#define ILC_FRAC_BITS (4)		// g_ilc_duty is in 1/16 duty cycle counts
+#define ILC_LEARN_GAIN (12)	// 1/16 duty cycle counts per mA at PWM_PERIOD
+#define ILC_DEADZONE_GAIN (8)
+#define ILC_DEADZONE_SHIFT (2)
+#define ILC_ERROR_MAX (127)
+
+// Position in the pulse, samples << ILC_POS_BITS
+#define ILC_POS_BITS (16)
+#define ILC_POS_LAST ((ILC_SAMPLES-1) << ILC_POS_BITS)
+// Length of `periods` PWM periods of `pwm_period` counts in samples << ILC_POS_BITS,
+// rounded up so that CTL_PERIOD always reaches the next sample
+#define ILC_STEP_OF(periods, pwm_period) \
+	(((((periods)*(pwm_period)) << ILC_POS_BITS) + CTL_PERIOD-1)/CTL_PERIOD)
+
+#if USE_ADAPTIVE_CTL_RATE || USE_RUNTIME_PWM_PERIOD
+extern volatile int g_ilc_step; // length of the last control period, set by control.c
+#define ILC_STEP (g_ilc_step)
+#else
+#define ILC_STEP (1 << ILC_POS_BITS)
+#endif
+
+// A duty cycle count is worth more current at a shorter PWM period
+#define ILC_GAIN_BITS (4)
+#if USE_RUNTIME_PWM_PERIOD
+extern volatile int g_ilc_gain; // ILC_LEARN_GAIN at PWM_PERIOD_NOW, set by control.c
+#define ILC_GAIN (g_ilc_gain)
+#else
+#define ILC_GAIN (ILC_LEARN_GAIN << ILC_GAIN_BITS)
+#endif
+
+extern volatile int16_t g_ilc_duty[ILC_SAMPLES];
+extern volatile int8_t g_ilc_error[ILC_SAMPLES];
+extern volatile int g_ilc_pos; // position in the pulse, -1 between pulses
+
+void ILC_Reset(int duty);
+
+// ILC duty cycle for the control ISR
+__STATIC_FORCEINLINE int ILC_Update(int set_mA, int measured_mA) {
+	int pos = g_ilc_pos, m = pos >> ILC_POS_BITS, n, e, a, b, u, step, lim;
+
+	if (set_mA <= 0) {
+		if (m >= 0) // pulse over: the last duty cycle's error is unknown
+			g_ilc_error[m] = 0;
+		g_ilc_pos = -1;
+		return 0;
+	}
+	if (m >= 0) { // error produced by the previous sample's duty cycle
+		e = set_mA - measured_mA;
+		if (e > ILC_ERROR_MAX)
+			e = ILC_ERROR_MAX;
+		else if (e < -ILC_ERROR_MAX)
+			e = -ILC_ERROR_MAX;
+		g_ilc_error[m] = e;
+		pos += ILC_STEP;
+		if (pos > ILC_POS_LAST)
+			pos = ILC_POS_LAST;
+	} else
+		pos = 0;
+	g_ilc_pos = pos;
+	n = pos >> ILC_POS_BITS;
+	if ((n == m) && (n < ILC_SAMPLES-1)) // same sample, already learned
+		return g_ilc_duty[n] >> ILC_FRAC_BITS;
+
+	// Last pulse's errors around n+1; duty cycles around n, n-1 already learned
+	a = (n < ILC_SAMPLES-1)? n+1 : n;
+	b = (a < ILC_SAMPLES-1)? a+1 : a;
+	e = (g_ilc_error[n] + 2*g_ilc_error[a] + g_ilc_error[b]) >> 2;
+	u = (g_ilc_duty[(m < 0)? n : m] + 2*g_ilc_duty[n] + g_ilc_duty[a]) >> 2;
+	step = (e*ILC_GAIN) >> ILC_GAIN_BITS;
+	if (g_ilc_error[n] >= set_mA) { // no current: below the LED's forward voltage
+		step *= ILC_DEADZONE_GAIN;
+		lim = ((LIM_DUTY_CYCLE << ILC_FRAC_BITS) - g_ilc_duty[n]) >> ILC_DEADZONE_SHIFT;
+		if (step > lim)
+			step = lim;
+	}
+	u += step;
+	if (u < 0)
+		u = 0;
+	else if (u > (LIM_DUTY_CYCLE << ILC_FRAC_BITS))
+		u = LIM_DUTY_CYCLE << ILC_FRAC_BITS;
+	g_ilc_duty[n] = u;
+	return u >> ILC_FRAC_BITS;
+}
+
+#endif // ILC_H
@@ -24,6 +24,16 @@
 #include "MMA8451.h"
 
 #include "config.h"
+#if ENABLE_KERNEL_BENCHMARK
+#include "bench.h"
+#endif
+#if USE_DUTY_FEEDFORWARD
+#include "feedforward.h"
+#include "ilc.h"
+#endif
+#if USE_AUTOTUNE
+#include "nvm.h"
+#endif
 #if ENABLE_COP_WATCHDOG
 #include "wdt.h"
 #endif
@@ -146,6 +156,28 @@ int main (void) {
 
 	Init_Buck_HBLED();
 	
+#if USE_AUTOTUNE
+	NVM_Load_PID_Gains(&plantPID_FX); // gains from the last autotune, if any
+#endif
+
+#if ENABLE_KERNEL_BENCHMARK
+	Bench_Run_On_Target();
+	LCD_Erase();
+#endif
+
+#if USE_DUTY_FEEDFORWARD
+	// Learn the current->duty table; the control ISR runs the sweep
+	FF_Learn_Start();
+	while (FF_Learning()) {
+#if ENABLE_COP_WATCHDOG
+		WDT_Feed();
+#endif
+	}
+	FF_Show_Table();
+	LCD_Erase();
+	ILC_Reset(FF_Duty(g_peak_set_current_mA)); // start learning near the answer
+#endif
+
 #if ENABLE_COP_WATCHDOG
 	WDT_Feed();  // Feed before RTOS init
 #endif
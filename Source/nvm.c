@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <string.h>
+#include <MKL25Z4.h>
+
+#include "nvm.h"
+
+// Stored record, programmed as whole longwords
+typedef struct {
+	uint32_t Magic;
+	FX16_16 PGain, IGain, DGain;
+	uint32_t Check;
+} NVM_PID_RECORD_T;
+
+static uint32_t NVM_Check(const NVM_PID_RECORD_T * r) {
+	return ~(r->Magic ^ (uint32_t) r->PGain ^ ((uint32_t) r->IGain << 1) ^ ((uint32_t) r->DGain << 2));
+}
+
+#ifdef SIM_HOST
+// Host simulator: the sector is plain memory
+static uint32_t nvm_sector[NVM_SECTOR_SIZE/4];
+#define NVM_RECORD ((const NVM_PID_RECORD_T *) nvm_sector)
+
+static int NVM_Erase_Sector(void) {
+	memset(nvm_sector, 0xFF, sizeof(nvm_sector));
+	return 1;
+}
+
+static int NVM_Program_Longword(uint32_t offset, uint32_t data) {
+	nvm_sector[offset/4] &= data;
+	return 1;
+}
+#else
+#define NVM_RECORD ((const NVM_PID_RECORD_T *) NVM_SECTOR_ADDR)
+
+#define FTFA_CMD_PGM4 (0x06)
+#define FTFA_CMD_ERSSCR (0x09)
+
+/* The flash cannot be read while a command runs, so the launch-and-wait
+ * loop runs from RAM. Thumb code, called as f(&FTFA->FSTAT, CCIF, &SIM->SRVCOP):
+ *   strb r1, [r0]         ; launch: write 1 to CCIF
+ * 1: movs r3, #0x55       ; service COP
+ *   str  r3, [r2]
+ *   movs r3, #0xAA
+ *   str  r3, [r2]
+ *   ldrb r3, [r0]
+ *   tst  r3, r1
+ *   beq  1b               ; until CCIF is set again
+ *   bx   lr
+ */
+static uint16_t nvm_launch_code[] = {
+	0x7001, 0x2355, 0x6013, 0x23AA, 0x6013, 0x7803, 0x420B, 0xD0F8, 0x4770
+};
+
+static int NVM_Run_Command(void) {
+	void (* launch)(volatile uint8_t *, uint8_t, volatile uint32_t *);
+
+	launch = (void (*)(volatile uint8_t *, uint8_t, volatile uint32_t *)) ((uintptr_t) nvm_launch_code | 1);
+	launch(&FTFA->FSTAT, FTFA_FSTAT_CCIF_MASK, &SIM->SRVCOP);
+	return !(FTFA->FSTAT & (FTFA_FSTAT_ACCERR_MASK | FTFA_FSTAT_FPVIOL_MASK | FTFA_FSTAT_MGSTAT0_MASK));
+}
+
+static void NVM_Set_Address(uint32_t addr) {
+	while (!(FTFA->FSTAT & FTFA_FSTAT_CCIF_MASK))
+		;
+	FTFA->FSTAT = FTFA_FSTAT_ACCERR_MASK | FTFA_FSTAT_FPVIOL_MASK; // clear old errors
+	FTFA->FCCOB1 = (uint8_t)(addr >> 16);
+	FTFA->FCCOB2 = (uint8_t)(addr >> 8);
+	FTFA->FCCOB3 = (uint8_t) addr;
+}
+
+static int NVM_Erase_Sector(void) {
+	NVM_Set_Address(NVM_SECTOR_ADDR);
+	FTFA->FCCOB0 = FTFA_CMD_ERSSCR;
+	return NVM_Run_Command();
+}
+
+static int NVM_Program_Longword(uint32_t offset, uint32_t data) {
+	NVM_Set_Address(NVM_SECTOR_ADDR + offset);
+	FTFA->FCCOB0 = FTFA_CMD_PGM4;
+	FTFA->FCCOB4 = (uint8_t)(data >> 24); // byte at highest address
+	FTFA->FCCOB5 = (uint8_t)(data >> 16);
+	FTFA->FCCOB6 = (uint8_t)(data >> 8);
+	FTFA->FCCOB7 = (uint8_t) data;
+	return NVM_Run_Command();
+}
+#endif // SIM_HOST
+
+int NVM_Save_PID_Gains(const SPidFX * pid) {
+	NVM_PID_RECORD_T r;
+	const uint32_t * w = (const uint32_t *) &r;
+	uint32_t i;
+
+	r.Magic = NVM_MAGIC;
+	r.PGain = pid->pGain;
+	r.IGain = pid->iGain;
+	r.DGain = pid->dGain;
+	r.Check = NVM_Check(&r);
+
+	if (!NVM_Erase_Sector())
+		return 0;
+	for (i = 0; i < sizeof(r)/4; i++) {
+		if (!NVM_Program_Longword(4*i, w[i]))
+			return 0;
+	}
+	return 1;
+}
+
+int NVM_Load_PID_Gains(SPidFX * pid) {
+	const NVM_PID_RECORD_T * r = NVM_RECORD;
+
+	if ((r->Magic != NVM_MAGIC) || (r->Check != NVM_Check(r)))
+		return 0;
+	pid->pGain = r->PGain;
+	pid->iGain = r->IGain;
+	pid->dGain = r->DGain;
+	return 1;
+}
@@ -0,0 +1,21 @@
+#ifndef NVM_H
+#define NVM_H
+
+#include <stdint.h>
+#include "control.h"
+
+/* Non-volatile parameter storage in the last 1 KB flash sector.
+ * The project's IROM size ends before this sector, so the linker never
+ * places code or constants there. The save functions erase and program
+ * the sector; call them with interrupts disabled, since ISRs execute from
+ * flash. The COP watchdog is serviced while the flash is busy.
+ */
+
+#define NVM_SECTOR_ADDR (0x0001FC00)
+#define NVM_SECTOR_SIZE (0x400)
+#define NVM_MAGIC (0x48424C31) // "HBL1"
+
+int NVM_Save_PID_Gains(const SPidFX * pid);
+int NVM_Load_PID_Gains(SPidFX * pid); // returns 0 and leaves pid alone if nothing valid is stored
+
+#endif // NVM_H
@@ -0,0 +1,91 @@
+#ifndef OVERCURRENT_H
+#define OVERCURRENT_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "config.h"
+#include "control.h"
+#include "timers.h"
+#if USE_DITHERED_PWM
+#include "pwm_dither.h"
+#endif
+
+/* Hardware overcurrent trip (ENABLE_OVERCURRENT_TRIP in config.h).
+ * With the compare function on (SC2 ACFE, ACFGT), a conversion only
+ * completes, setting COCO and interrupting, if its result is at least CV1.
+ * So compare conversions cannot also serve as control samples. Between
+ * control conversions the ADC instead converts the sense channel
+ * continuously (SC3 ADCO) in compare mode against OVERCURRENT_TRIP_CODE:
+ *   - the ADC ISR arms it after the control update (or after a
+ *     low-priority conversion)
+ *   - TPM0_IRQHandler disarms it before starting a control conversion, and
+ *     the ADC server before starting a low-priority one. TPM0 preempts the
+ *     ADC ISR, so a compare conversion can have completed with its
+ *     interrupt still pending; the disarm trips on it then
+ * Below the limit this costs no interrupts and nothing in Control_HBLED.
+ * A result at or above the limit interrupts within one conversion time
+ * (ADC_CONV_TIME_NS) and Overcurrent_Trip turns the LED off at once: PTE31
+ * is switched from TPM0 CH4 to GPIO, which drives the off level, instead of
+ * waiting for the next PWM reload. The trip latches control off until the
+ * "Ctlr" field turns it back on (Overcurrent_Clear).
+ */
+
+#define OVERCURRENT_TRIP_CODE (MA_To_ADC_Code(OVERCURRENT_TRIP_mA)) // folded to a constant
+#define HBLED_PWM_PIN (31)		// PTE31, TPM0 CH4 on MUX 3
+#define HBLED_PWM_MUX (3)
+
+#if ENABLE_OVERCURRENT_TRIP && !USE_SYNC_SW_CTL_FREQ_DIV
+#error "ENABLE_OVERCURRENT_TRIP needs the software-started control conversions (USE_SYNC_SW_CTL_FREQ_DIV)"
+#endif
+
+extern volatile int g_overcurrent_trips;
+
+// Continuous compare conversions on the sense channel
+__STATIC_FORCEINLINE void Overcurrent_Arm(void) {
+	ADC0->CV1 = OVERCURRENT_TRIP_CODE;
+	ADC0->SC2 |= ADC_SC2_ACFE_MASK | ADC_SC2_ACFGT_MASK;
+	ADC0->SC3 |= ADC_SC3_ADCO_MASK;
+	ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
+}
+
+// ADC ISR: was this a compare conversion, i.e. an overcurrent?
+__STATIC_FORCEINLINE int Overcurrent_Armed(void) {
+	return (ADC0->SC2 & ADC_SC2_ACFE_MASK) != 0;
+}
+
+__STATIC_FORCEINLINE void Overcurrent_Stop(void) {
+	ADC0->SC2 &= ~(ADC_SC2_ACFE_MASK | ADC_SC2_ACFGT_MASK);
+	ADC0->SC3 &= ~ADC_SC3_ADCO_MASK;
+}
+
+__STATIC_FORCEINLINE void Overcurrent_Trip(void) {
+	Overcurrent_Stop();
+	if ((PORTE->PCR[HBLED_PWM_PIN] & PORT_PCR_MUX_MASK) == PORT_PCR_MUX(HBLED_PWM_MUX))
+		g_overcurrent_trips++; // not a repeat while the current decays
+	PORTE->PCR[HBLED_PWM_PIN] = (PORTE->PCR[HBLED_PWM_PIN] & ~PORT_PCR_MUX_MASK) | PORT_PCR_MUX(1); // LED off now
+	(void) ADC0->R[0]; // clears COCO
+	g_duty_cycle = 0;
+#if USE_DITHERED_PWM
+	PWM_Dither_Set(0);
+#endif
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, 0);
+	g_enable_control = 0;
+	Control_Select_ISR();
+}
+
+/* Back to single conversions; the caller's SC1 write aborts the current one.
+ * A compare conversion that already completed is an overcurrent whose ADC
+ * interrupt is pending behind the caller: once disarmed, the ADC ISR would
+ * take its result for a control sample. Trip now and drop that interrupt. */
+__STATIC_FORCEINLINE void Overcurrent_Disarm(void) {
+	if (Overcurrent_Armed() && (ADC0->SC1[0] & ADC_SC1_COCO_MASK)) {
+		Overcurrent_Trip(); // reads R[0], clearing COCO
+		NVIC_ClearPendingIRQ(ADC0_IRQn);
+		return;
+	}
+	Overcurrent_Stop();
+}
+
+void Overcurrent_Clear(void);
+
+#endif // OVERCURRENT_H
@@ -0,0 +1,37 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "FX.h"
+#include "control.h"
+
+/* Current predictor for the ADC and PWM latency (USE_CURRENT_PREDICTOR).
+ * The sample the control ISR reads was taken just after a TPM0 overflow,
+ * and the duty cycle it writes takes effect at the next PWM reload, one PWM
+ * period later. Until then the previous duty cycle still drives the
+ * inductor. The predictor estimates the current at that reload:
+ *   i_pred = Alpha*i + Beta*u_prev + Gamma
+ * This is the plant's one-PWM-period step at the sampling phase. PID_FX and
+ * PID_FX_GS use i_pred in place of the measured current. The coefficients
+ * come from the plant identification that generates deadbeat_table.c
+ * (make -C Simulator deadbeat-table).
+ */
+
+typedef struct {
+	FX16_16 Alpha;	// per PWM period
+	FX16_16 Beta;		// mA per duty cycle count
+	FX16_16 Gamma;	// mA
+} CURRENT_PREDICTOR_T;
+
+extern const CURRENT_PREDICTOR_T Current_Predictor;
+
+// Predicted current in mA (FX16_16) when the duty cycle written now applies
+__STATIC_FORCEINLINE FX16_16 Predict_Current_FX(int measured_mA, int prev_duty) {
+	FX16_16 i;
+
+	i = Current_Predictor.Alpha*measured_mA + Current_Predictor.Beta*prev_duty + Current_Predictor.Gamma;
+	return (i > 0)? i : 0; // the LED blocks reverse current
+}
+
+#endif // PREDICTOR_H
@@ -0,0 +1,57 @@
+#ifndef PWM_DITHER_H
+#define PWM_DITHER_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+
+/* Sigma-delta dithered PWM (USE_DITHERED_PWM in control.h).
+ * The duty cycle has DITHER_BITS fraction bits: PID_FX and PID_FX_GS keep the
+ * fraction of their output in g_duty_frac instead of truncating it, and the
+ * control ISR publishes g_duty_cycle.g_duty_frac as g_pwm_duty_q. Every PWM
+ * period a first-order sigma-delta modulator writes CnV:
+ *   s = err + duty_q,  CnV = s >> DITHER_BITS,  err = s - (CnV << DITHER_BITS)
+ * so the mean of CnV over 2^DITHER_BITS periods is the fractional duty cycle
+ * and its error is shaped toward the switching frequency, which the LC filter
+ * attenuates. This gives PWM_PERIOD_NOW*DITHER_ONE duty steps instead of
+ * PWM_PERIOD_NOW: 12000 instead of 750 at the default PWM_PERIOD.
+ *
+ * Each PWM period gets exactly one modulator step: the control ISR takes it
+ * in the periods where it runs (so a new duty cycle still applies at the next
+ * reload), and TPM0_IRQHandler takes it in the others. CnV is clamped to
+ * [0, LIM_DUTY_CYCLE], dropping the remainder, so a duty cycle out of range
+ * (e.g. just after a PWM period change) cannot wind up the modulator. The
+ * ISR cost is three adds, two shifts, two compares and the CnV write.
+ */
+
+#define DITHER_BITS (4)
+#define DITHER_ONE (1<<DITHER_BITS)
+
+extern volatile int g_duty_frac;				// fraction of g_duty_cycle, 1/DITHER_ONE counts
+extern volatile int32_t g_pwm_duty_q;		// duty cycle to modulate, 1/DITHER_ONE counts
+extern volatile int32_t g_pwm_dither_err;	// modulator state
+
+// One modulator step: CnV for the next PWM period
+__STATIC_FORCEINLINE void PWM_Dither_Step(void) {
+	int32_t s, cnv;
+
+	s = g_pwm_dither_err + g_pwm_duty_q;
+	cnv = s >> DITHER_BITS;
+	if (cnv < 0) {
+		cnv = 0;
+		s = 0;
+	} else if (cnv > LIM_DUTY_CYCLE) {
+		cnv = LIM_DUTY_CYCLE;
+		s = cnv << DITHER_BITS;
+	}
+	g_pwm_dither_err = s - (cnv << DITHER_BITS);
+	TPM0->CONTROLS[PWM_HBLED_CHANNEL].CnV = cnv;
+}
+
+// Integer duty cycle set outside the control ISR (UI, open loop)
+__STATIC_FORCEINLINE void PWM_Dither_Set(int duty) {
+	g_duty_frac = 0;
+	g_pwm_duty_q = duty << DITHER_BITS;
+}
+
+#endif // PWM_DITHER_H
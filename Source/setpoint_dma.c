@@ -0,0 +1,121 @@
+#include <MKL25Z4.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "control.h"
+#include "timers.h"
+#include "DMA.h"
+#include "debug.h"
+#include "waveform.h"
+#include "setpoint_dma.h"
+
+SP_DMA_TABLE_T g_sp_dma_table[2];
+volatile int g_sp_dma_on = 0;
+volatile int g_sp_dma_play = 0, g_sp_dma_ready = 0;
+volatile int g_sp_dma_last_mA = 0, g_sp_dma_last_code = 0;
+
+// Append ms of sample s, merged into the last run if it has the same setpoint
+static void Setpoint_DMA_Run(SP_DMA_TABLE_T * t, const WAVE_SAMPLE_T * s, int ms) {
+	int k = t->Runs;
+
+	if ((k > 0) && (t->mA[k - 1] == s->mA)) {
+		t->Next_LDVAL[k - 1] += ms*SP_DMA_PIT_PER_MS;
+		return;
+	}
+	t->mA[k] = s->mA;
+	t->Scope_Code[k] = s->Code;
+	t->DAC_Code[k] = s->DAC;
+	t->Next_LDVAL[k] = ms*SP_DMA_PIT_PER_MS - 1; // shifted below
+	t->Runs = k + 1;
+}
+
+// Compile the flash as Update_Set_Current plays it into runs
+static void Setpoint_DMA_Build(SP_DMA_TABLE_T * t) {
+	int k, n, first;
+
+	Wave_Update();
+	t->Period = g_flash_period;
+	t->Version = g_wave_version;
+	t->Runs = 0;
+	if ((g_wave_duration < 1) || (g_wave_duration >= t->Period)) {
+		Setpoint_DMA_Run(t, &g_wave_off, t->Period); // never on
+	} else {
+		Setpoint_DMA_Run(t, &g_wave_off, t->Period - g_wave_duration);
+		// One run per table entry: 1 ms each, or a slice of a pulse longer
+		// than WAVE_MAX_SAMPLES ms, which steps instead of interpolating
+		n = g_wave_samples;
+		for (k = 0; k < n; k++)
+			Setpoint_DMA_Run(t, &g_wave_table[k], ((k + 1)*g_wave_duration)/n - (k*g_wave_duration)/n);
+	}
+	// The transfer starting run k loads the PIT for run k+1
+	first = t->LDVAL0 = t->Next_LDVAL[0];
+	for (k = 0; k < t->Runs - 1; k++)
+		t->Next_LDVAL[k] = t->Next_LDVAL[k + 1];
+	t->Next_LDVAL[t->Runs - 1] = first; // DMA1_IRQHandler overwrites it when the table changes
+}
+
+static void Setpoint_DMA_Start(void) {
+	SP_DMA_TABLE_T * t = &g_sp_dma_table[g_sp_dma_play];
+
+	g_sp_dma_last_mA = 0;
+	g_sp_dma_last_code = 0;
+	Set_DAC(0);
+	Start_DMA_Setpoint(SP_DMA_CH, SP_DMA_LINK_CH, t->DAC_Code, t->Next_LDVAL, t->Runs);
+	g_sp_dma_on = 1;
+	PIT_Init_Trigger(SP_DMA_CH, SP_DMA_START_MS*SP_DMA_PIT_PER_MS - 1, t->LDVAL0);
+}
+
+static void Setpoint_DMA_Stop(void) {
+	PIT_Stop(SP_DMA_CH);
+	Stop_DMA_Setpoint(SP_DMA_CH);
+	g_sp_dma_on = 0;
+}
+
+void Setpoint_DMA_Init(void) {
+	DMA_Init();
+	Configure_DMA_For_Setpoint(SP_DMA_CH, SP_DMA_LINK_CH);
+}
+
+/* Called from Thread_Update_Setpoint. Starts and stops playback with
+ * g_enable_flash, and builds a new table when the flash changed. It only
+ * writes the table that is neither playing nor waiting to play, so the
+ * DMA ISR never switches to a table being built. */
+void Setpoint_DMA_Service(void) {
+	SP_DMA_TABLE_T * t;
+	int next;
+
+	if (!g_enable_flash) {
+		if (g_sp_dma_on)
+			Setpoint_DMA_Stop(); // g_set_current_mA is the UI's again
+		return;
+	}
+	if (!g_sp_dma_on) {
+		g_sp_dma_play = g_sp_dma_ready = 0;
+		Setpoint_DMA_Build(&g_sp_dma_table[0]);
+		Setpoint_DMA_Start();
+		return;
+	}
+	if (g_sp_dma_ready != g_sp_dma_play)
+		return; // switch pending
+	Wave_Update(); // the DMA plays its own copy, so the wave table may change now
+	t = &g_sp_dma_table[g_sp_dma_play];
+	if ((t->Period == g_flash_period) && (t->Version == g_wave_version))
+		return;
+	next = 1 - g_sp_dma_play;
+	Setpoint_DMA_Build(&g_sp_dma_table[next]);
+	g_sp_dma_ready = next;
+}
+
+// The last run of the flash period has started
+void DMA1_IRQHandler(void) {
+	SP_DMA_TABLE_T * t = &g_sp_dma_table[g_sp_dma_play];
+
+	DEBUG_START(DBG_DMA_ISR_POS);
+	g_sp_dma_last_mA = t->mA[t->Runs - 1];
+	g_sp_dma_last_code = t->Scope_Code[t->Runs - 1];
+	g_sp_dma_play = g_sp_dma_ready;
+	t = &g_sp_dma_table[g_sp_dma_play];
+	PIT->CHANNEL[SP_DMA_CH].LDVAL = t->LDVAL0; // the link wrote the old table's
+	Start_DMA_Setpoint(SP_DMA_CH, SP_DMA_LINK_CH, t->DAC_Code, t->Next_LDVAL, t->Runs);
+	DEBUG_STOP(DBG_DMA_ISR_POS);
+}
@@ -0,0 +1,77 @@
+#ifndef SETPOINT_DMA_H
+#define SETPOINT_DMA_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+#include "waveform.h"
+
+/* DMA setpoint playback (USE_DMA_SETPOINT in control.h).
+ * Setpoint_DMA_Build compiles one flash period into runs, each with a DAC
+ * code, its setpoint in mA and scope code, and a length: off for
+ * g_flash_period - g_wave_duration ms, then the compiled waveform
+ * (waveform.h) with equal samples merged. The rectangle is two runs.
+ *
+ * PIT channel SP_DMA_CH times the runs and, through the DMAMUX periodic
+ * trigger, requests DMA channel SP_DMA_CH at the end of each one. That
+ * transfer writes the next run's DAC code; its channel link to
+ * SP_DMA_LINK_CH writes the length of the run after that to the PIT's
+ * LDVAL, which the PIT loads when the run ends. Every setpoint edge is a
+ * PIT expiry, with no thread or ISR latency in it.
+ *
+ * DMA1_IRQHandler runs once per flash period, when the last run starts: it
+ * switches to the table Thread_Update_Setpoint built if the flash
+ * parameters changed and restarts both channels. The thread only needs to
+ * wake every THREAD_SETPOINT_DMA_PERIOD_TICKS (COP feed, rebuilds) instead
+ * of every ms.
+ *
+ * The control ISR gets the setpoint from the DMA's byte count
+ * (Setpoint_DMA_Update) and writes g_set_current_mA and g_set_current_code
+ * itself. The DMA ISR has the ADC ISR's priority, so neither sees the
+ * other's update half done.
+ */
+
+#define SP_DMA_MAX_RUNS (WAVE_MAX_SAMPLES + 1)
+#define SP_DMA_CH (1)							// PIT channel n triggers DMA channel n
+#define SP_DMA_LINK_CH (2)
+#define SP_DMA_PIT_PER_MS (24000)	// PIT counts at the 24 MHz bus clock
+#define SP_DMA_START_MS (1)				// off before the first run
+
+typedef struct {
+	uint16_t DAC_Code[SP_DMA_MAX_RUNS];		// DMA source
+	uint32_t Next_LDVAL[SP_DMA_MAX_RUNS];	// DMA source: PIT load for the run after the next
+	int16_t mA[SP_DMA_MAX_RUNS];
+	uint16_t Scope_Code[SP_DMA_MAX_RUNS];
+	uint32_t LDVAL0;		// PIT load for the first run
+	int Runs;
+	int Period, Version;	// flash period and g_wave_version it was built from
+} SP_DMA_TABLE_T;
+
+extern SP_DMA_TABLE_T g_sp_dma_table[2];
+extern volatile int g_sp_dma_on;
+extern volatile int g_sp_dma_play;		// table being played
+extern volatile int g_sp_dma_ready;		// table to play from the next flash period
+extern volatile int g_sp_dma_last_mA, g_sp_dma_last_code; // last run of the previous table
+
+void Setpoint_DMA_Init(void);
+void Setpoint_DMA_Service(void);	// from Thread_Update_Setpoint
+
+// Control ISR: setpoint of the run being played
+__STATIC_FORCEINLINE void Setpoint_DMA_Update(void) {
+	const SP_DMA_TABLE_T * t;
+	int k;
+
+	if (!g_sp_dma_on)
+		return;
+	t = &g_sp_dma_table[g_sp_dma_play];
+	k = t->Runs - (int)((DMA0->DMA[SP_DMA_CH].DSR_BCR & DMA_DSR_BCR_BCR_MASK) >> 1) - 1;
+	if (k < 0) { // no transfer from this table yet
+		g_set_current_mA = g_sp_dma_last_mA;
+		g_set_current_code = g_sp_dma_last_code;
+	} else {
+		g_set_current_mA = t->mA[k];
+		g_set_current_code = t->Scope_Code[k];
+	}
+}
+
+#endif // SETPOINT_DMA_H
@@ -0,0 +1,96 @@
+#include <MKL25Z4.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "control.h"
+#include "ST7789.h"
+#include "setpoint_shape.h"
+
+static int16_t shape_profiles[SHAPE_COUNT][SHAPE_SAMPLES];
+
+const int16_t * volatile g_shape_table = shape_profiles[Shape_None];
+volatile SHAPE_PROFILE_E g_shape_profile = Shape_None;
+volatile int g_shape_rise_us[SHAPE_COUNT] = {-1, -1, -1, -1};
+volatile int g_shape_rise_now_us = -1;
+volatile int g_shape_from_mA = 0, g_shape_to_mA = 0;
+volatile int g_shape_n = SHAPE_SAMPLES;
+
+void Shape_Init(void) {
+	int n, x, x3, k, q;
+
+	for (n = 0; n < SHAPE_SAMPLES; n++) {
+		shape_profiles[Shape_None][n] = SHAPE_ONE;
+		shape_profiles[Shape_Overdrive][n] = (n < SHAPE_OVERDRIVE_SAMPLES)?
+			SHAPE_ONE + (SHAPE_ONE*SHAPE_OVERDRIVE_PCT)/100 : SHAPE_ONE;
+		if (n < SHAPE_RAMP_SAMPLES) {
+			x = ((n + 1) << SHAPE_FRAC_BITS)/SHAPE_RAMP_SAMPLES;
+			x3 = (x*((x*x) >> SHAPE_FRAC_BITS)) >> SHAPE_FRAC_BITS;
+			// x^3*(10 + x*(6x - 15)), Q12 products stay below 2^28
+			shape_profiles[Shape_Ramp][n] = (x3*(10*SHAPE_ONE + ((x*(6*x - 15*SHAPE_ONE)) >> SHAPE_FRAC_BITS))) >> SHAPE_FRAC_BITS;
+		} else {
+			shape_profiles[Shape_Ramp][n] = SHAPE_ONE;
+		}
+	}
+	// Inverse: 1 + (K-1)*q^n
+	k = ((SHAPE_ONE - SHAPE_TARGET_POLE) << SHAPE_FRAC_BITS)/(SHAPE_ONE - SHAPE_PLANT_POLE);
+	if (k > SHAPE_MAX)
+		k = SHAPE_MAX;
+	q = k - SHAPE_ONE;
+	for (n = 0; n < SHAPE_SAMPLES; n++) {
+		shape_profiles[Shape_Inverse][n] = SHAPE_ONE + q;
+		q = (q*SHAPE_TARGET_POLE) >> SHAPE_FRAC_BITS;
+	}
+	Shape_Select(SHAPE_DEF_PROFILE);
+}
+
+void Shape_Select(SHAPE_PROFILE_E p) {
+	if ((unsigned) p >= SHAPE_COUNT)
+		return;
+	g_shape_profile = p;
+	g_shape_table = shape_profiles[p]; // one store: the ISR sees the old or the new profile
+	g_shape_rise_now_us = g_shape_rise_us[p];
+}
+
+// 10-90% rise time of the first pulse in the capture, -1 if none
+static int Shape_Rise_us(void) {
+	int i = 0, set, lo, hi, m, prev, t10 = -1, t90 = -1;
+
+	while ((i < SAM_BUF_SIZE) && (g_set_sample[i] == 0))
+		i++;
+	if (i >= SAM_BUF_SIZE)
+		return -1;
+	set = g_set_sample[i];
+	if (set < 10)
+		return -1; // too small to resolve 10%
+	lo = set/10;
+	hi = set - lo;
+	prev = 0;
+	for (; (i < SAM_BUF_SIZE) && (g_set_sample[i] == set); i++) {
+		// Crossing times in 1/16 samples, interpolated between samples
+		m = g_meas_sample[i];
+		if ((t10 < 0) && (m >= lo))
+			t10 = 16*i - (16*(m - lo))/(m - prev);
+		if (m >= hi) {
+			t90 = 16*i - (16*(m - hi))/(m - prev);
+			break;
+		}
+		prev = m;
+	}
+	if (t90 < 0)
+		return -1;
+	return ((t90 - t10)*CTL_PERIOD_NOW)/(16*24); // CTL_PERIOD_NOW counts at 24 MHz
+}
+
+void Shape_Process_Capture(void) {
+	int r = Shape_Rise_us();
+
+	if (r < 0)
+		return;
+	g_shape_rise_us[g_shape_profile] = r;
+	g_shape_rise_now_us = r;
+}
+
+// UI: the slider position selects the profile; the field shows its rise time
+void Shape_Handler(UI_FIELD_T * fld, int v) {
+	Shape_Select((SHAPE_PROFILE_E) (((v + UI_SLIDER_WIDTH/2)*SHAPE_COUNT)/(UI_SLIDER_WIDTH + 1)));
+}
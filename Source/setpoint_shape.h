@@ -0,0 +1,85 @@
+#ifndef SETPOINT_SHAPE_H
+#define SETPOINT_SHAPE_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+#include "UI.h"
+
+/* Setpoint shaping (USE_SETPOINT_SHAPING in control.h).
+ * Update_Set_Current steps g_set_current_mA once per ms. At each step the
+ * control ISR replaces it, for SHAPE_SAMPLES control periods, with
+ *   from + (to - from)*profile[n]/SHAPE_ONE
+ * where n counts control periods since the step, and then follows it
+ * unchanged. The profile is a fraction of the step in Q12:
+ *   Shape_None       1 (plain step)
+ *   Shape_Overdrive  1 + SHAPE_OVERDRIVE_PCT% for SHAPE_OVERDRIVE_SAMPLES
+ *   Shape_Ramp       smootherstep 6x^5-15x^4+10x^3 over SHAPE_RAMP_SAMPLES:
+ *                    slope and curvature are zero at both ends, so the
+ *                    step has neither a slope nor an acceleration jump
+ *   Shape_Inverse    1 + (K-1)*q^n, K = (1-q)/(1-p): cancels a first-order
+ *                    closed-loop pole p and puts one at q
+ * The shaped setpoint stays within SHAPE_MAX_OVER_mA of the target, so a
+ * profile above 1 adds at most that much to the overshoot whatever the step.
+ * Shape_Init computes all profiles at startup; the ISR cost is a compare,
+ * one table lookup, a multiply and a shift. Only the control modes see the
+ * shaped setpoint: the scope, feedforward and the rise-time measurement
+ * use the flash generator's.
+ *
+ * Thread_Draw_Waveforms hands each full scope capture to Shape_Process_Capture,
+ * which measures the 10-90% rise time of the measured current for the
+ * profile in use. The UI shows it next to the rise time with Shape_None,
+ * and the "Rise" field's slider position selects the profile.
+ */
+
+#define SHAPE_SAMPLES (16)
+#define SHAPE_FRAC_BITS (12)
+#define SHAPE_ONE (1<<SHAPE_FRAC_BITS)
+
+// Overdrive and Inverse suit the autotuned PI gains (rise about 12 control
+// periods), Ramp the Deadbeat mode, which reaches the step in one.
+#define SHAPE_OVERDRIVE_PCT (200)
+#define SHAPE_OVERDRIVE_SAMPLES (2)
+#define SHAPE_RAMP_SAMPLES (3)
+#define SHAPE_PLANT_POLE (SHAPE_ONE*9/10)		// p, Q12: dominant closed-loop pole
+#define SHAPE_TARGET_POLE (SHAPE_ONE*6/10)	// q, Q12
+#define SHAPE_MAX (3*SHAPE_ONE)							// profile limit, Q12
+#define SHAPE_MAX_OVER_mA (10)								// shaped setpoint limit past the target
+
+typedef enum {Shape_None, Shape_Overdrive, Shape_Ramp, Shape_Inverse, SHAPE_COUNT} SHAPE_PROFILE_E;
+
+// Ramp: the lowest overshoot with both the default PID_FX gains and Deadbeat
+#define SHAPE_DEF_PROFILE (Shape_Ramp)
+
+extern const int16_t * volatile g_shape_table;	// profile in use
+extern volatile SHAPE_PROFILE_E g_shape_profile;
+extern volatile int g_shape_rise_us[SHAPE_COUNT]; // last rise time per profile, -1 if none
+extern volatile int g_shape_rise_now_us;					// rise time with g_shape_profile
+extern volatile int g_shape_from_mA, g_shape_to_mA, g_shape_n;
+
+void Shape_Init(void);
+void Shape_Select(SHAPE_PROFILE_E p);
+void Shape_Process_Capture(void); // call with g_scope_state == Full
+void Shape_Handler(UI_FIELD_T * fld, int v);
+
+// Shaped setpoint for the control ISR
+__STATIC_FORCEINLINE int Shape_Setpoint(int set_mA) {
+	int n = g_shape_n, s;
+
+	if (set_mA != g_shape_to_mA) { // new step, from the last target
+		g_shape_from_mA = g_shape_to_mA;
+		g_shape_to_mA = set_mA;
+		n = 0;
+	}
+	if (n >= SHAPE_SAMPLES)
+		return set_mA;
+	g_shape_n = n + 1;
+	s = g_shape_from_mA + (((set_mA - g_shape_from_mA)*g_shape_table[n]) >> SHAPE_FRAC_BITS);
+	if (s > set_mA + SHAPE_MAX_OVER_mA)
+		s = set_mA + SHAPE_MAX_OVER_mA;
+	else if (s < set_mA - SHAPE_MAX_OVER_mA)
+		s = set_mA - SHAPE_MAX_OVER_mA;
+	return (s > 0)? s : 0;
+}
+
+#endif // SETPOINT_SHAPE_H
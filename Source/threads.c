@@ -28,6 +28,15 @@
 #if ENABLE_COP_WATCHDOG
 #include "wdt.h"
 #endif
+#if USE_AUTOTUNE
+#include "autotune.h"
+#endif
+#if USE_SETPOINT_SHAPING
+#include "setpoint_shape.h"
+#endif
+#if USE_DMA_SETPOINT
+#include "setpoint_dma.h"
+#endif
 
 void Thread_Read_Touchscreen(void * arg); // 
 void Thread_Draw_Waveforms(void * arg);
@@ -123,6 +132,12 @@ void Thread_Draw_Waveforms(void * arg) {
 			// Buffer is full and ready to plot
 			// Transition to Plotting state - ISR will not write to buffers
 			g_scope_state = Plotting;
+#if USE_AUTOTUNE
+			Autotune_Process_Capture(); // relay analysis or settling time
+#endif
+#if USE_SETPOINT_SHAPING
+			Shape_Process_Capture(); // rise time
+#endif
 			
 #if USE_LCD_MUTEX_LEVEL==1
 			DEBUG_START(DBG_BLOCKING_LCD_POS);
@@ -148,6 +163,12 @@ void Thread_Draw_Waveforms(void * arg) {
 			// Buffers are full and ready to plot
 			// Transition to Plotting state - ISR will not write to buffers
 			g_scope_state = Plotting;
+#if USE_AUTOTUNE
+			Autotune_Process_Capture(); // relay analysis or settling time
+#endif
+#if USE_SETPOINT_SHAPING
+			Shape_Process_Capture(); // rise time
+#endif
 			
 #if USE_LCD_MUTEX_LEVEL==1
 			DEBUG_START(DBG_BLOCKING_LCD_POS);
@@ -203,7 +224,11 @@ void Thread_Draw_UI_Controls(void * arg) {
  
   tick = osKernelGetTickCount();        // retrieve the number of system ticks
 	while (1) {
+#if USE_DMA_SETPOINT
+		tick += THREAD_SETPOINT_DMA_PERIOD_TICKS; // the DMA times the flash
+#else
 		tick += THREAD_UPDATE_SETPOINT_PERIOD_TICKS;
+#endif
 		osDelayUntil(tick); 
 		DEBUG_START(DBG_TUSP_POS);
 		
@@ -243,9 +268,9 @@ void Thread_Draw_UI_Controls(void * arg) {
 #if ENABLE_TPM_SCRUB
 		// Fault Protection: Restore TPM0->MOD to correct value (protects against TR_Slow_TPM)
 		// The fault sets TPM0->MOD to 23456, breaking PWM timing
-		// We restore it to PWM_PERIOD to maintain correct switching frequency
-		if (TPM0->MOD != PWM_PERIOD) {
-			TPM0->MOD = PWM_PERIOD;
+		// We restore it to PWM_PERIOD_NOW to maintain correct switching frequency
+		if (TPM0->MOD != PWM_PERIOD_NOW) {
+			TPM0->MOD = PWM_PERIOD_NOW;
 		}
 #endif
 
@@ -254,6 +279,9 @@ void Thread_Draw_UI_Controls(void * arg) {
 		// The fault clears SIM->SCGC6, disabling ADC0, TPM0, etc.
 		// We restore the essential clocks needed for LED control
 		SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK | SIM_SCGC6_TPM0_MASK | SIM_SCGC6_DAC0_MASK;
+#if USE_SYNC_HW_CTL_FREQ_DIV
+		SIM->SCGC6 |= SIM_SCGC6_TPM2_MASK; // control trigger timer
+#endif
 #endif
 
 #if ENABLE_MCG_SCRUB
@@ -268,7 +296,11 @@ void Thread_Draw_UI_Controls(void * arg) {
 		}
 #endif
 		
+#if USE_DMA_SETPOINT
+		Setpoint_DMA_Service();
+#else
 		Update_Set_Current();
+#endif
 		DEBUG_STOP(DBG_TUSP_POS);
 	}
  }
@@ -291,7 +323,7 @@ void Thread_Read_Accelerometer(void * arg) {
 		if ((s & 0x08)) { 
 			read_full_xyz();
 			convert_xyz_to_roll_pitch();
-			period = 30 + (int) roll;
+			period = 30 + roll;
 			period = MAX(2, period);
 			g_flash_period = MIN(period, 180);
 			g_flash_duration = MAX(1, g_flash_period/4);
@@ -5,6 +5,12 @@
 #include "debug.h"
 // #include "HBLED.h"
 #include "control.h"
+#if USE_DITHERED_PWM
+#include "pwm_dither.h"
+#endif
+#if ENABLE_OVERCURRENT_TRIP
+#include "overcurrent.h"
+#endif
 
 volatile unsigned PIT_interrupt_counter = 0;
 volatile unsigned LCD_update_requested = 0;
@@ -45,6 +51,18 @@ void PIT_Init(int ch, unsigned period) {
 	NVIC_EnableIRQ(PIT_IRQn);	
 }
 
+// Periodic trigger only (DMAMUX), no interrupt. The first period is first,
+// then period: LDVAL written while running is loaded at the next expiry.
+void PIT_Init_Trigger(int ch, unsigned first, unsigned period) {
+	SIM->SCGC6 |= SIM_SCGC6_PIT_MASK;
+	PIT->MCR &= ~PIT_MCR_MDIS_MASK;
+	PIT->MCR |= PIT_MCR_FRZ_MASK;
+	PIT->CHANNEL[ch].TCTRL = 0;
+	PIT->CHANNEL[ch].LDVAL = PIT_LDVAL_TSV(first);
+	PIT->CHANNEL[ch].TCTRL = PIT_TCTRL_TEN_MASK;
+	PIT->CHANNEL[ch].LDVAL = PIT_LDVAL_TSV(period);
+}
+
 void PIT_Start(int ch) {
 // Enable counter
 	PIT->CHANNEL[ch].TCTRL |= PIT_TCTRL_TEN_MASK;
@@ -109,6 +127,38 @@ void PWM_Set_Value(TPM_Type * TPM, uint8_t channel_num, uint16_t value) {
 }
 
 
+/* Up-counting timer whose overflow serves as a hardware trigger every
+ * period counts. The counter is held until start_trigger (a TRGSEL code,
+ * e.g. another TPM's overflow) fires once, which aligns the two timers. */
+void TPM_Init_Trigger_Divider(TPM_Type * TPM, uint16_t period, uint8_t start_trigger) {
+	TPM_Init_Trigger_Phase(TPM, period, period, start_trigger);
+}
+
+/* As TPM_Init_Trigger_Divider, but the first overflow comes first counts
+ * after start_trigger, so the triggers keep that phase relative to it.
+ * MOD is written directly while the timer is disabled; the second write is
+ * buffered and loaded at the first overflow. */
+void TPM_Init_Trigger_Phase(TPM_Type * TPM, uint16_t period, uint16_t first, uint8_t start_trigger) {
+	//turn on clock to TPM 
+	if (TPM == TPM0)
+		SIM->SCGC6 |= SIM_SCGC6_TPM0_MASK;
+	else if (TPM == TPM1)
+		SIM->SCGC6 |= SIM_SCGC6_TPM1_MASK;
+	else if (TPM == TPM2)
+		SIM->SCGC6 |= SIM_SCGC6_TPM2_MASK;
+	//set clock source for tpm
+	SIM->SOPT2 |= (SIM_SOPT2_TPMSRC(1) | SIM_SOPT2_PLLFLLSEL_MASK);
+
+	TPM->SC = 0;
+	TPM->CNT = 0;
+	TPM->MOD = first - 1;
+	// Counter starts on trigger, keep running when in debug
+	TPM->CONF = TPM_CONF_CSOT_MASK | TPM_CONF_TRGSEL(start_trigger) | TPM_CONF_DBGMODE(0);
+	// Count up, divide by 1, enable: waits for the trigger before counting
+	TPM->SC = TPM_SC_PS(0) | TPM_SC_CMOD(1);
+	TPM->MOD = period - 1;
+}
+
 void TPM0_Init(void) {
 	//turn on clock to TPM 
 	SIM->SCGC6 |= SIM_SCGC6_TPM0_MASK;
@@ -146,26 +196,46 @@ void TPM0_Start(void) {
 	TPM0->SC |= TPM_SC_CMOD(1);
 }
 
+volatile uint32_t g_ctl_divider = SW_CTL_FREQ_DIV_FACTOR;
+
 void TPM0_IRQHandler() {
-	static uint32_t control_divider = SW_CTL_FREQ_DIV_FACTOR;
-	
 	DEBUG_START(DBG_TPM_ISR_POS);
 	//clear pending IRQ flag
 	TPM0->SC |= TPM_SC_TOF_MASK; 
 
-	control_divider--;
-	if (control_divider == 0) {
-		control_divider = SW_CTL_FREQ_DIV_FACTOR;
+#if USE_ADC_OVERSAMPLING
+	// Convert every period; the ADC ISR decimates and runs the control update (adc_decim.h)
+#if ENABLE_OVERCURRENT_TRIP
+	Overcurrent_Disarm();
+#endif
+	ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
+#else
+#if USE_ADAPTIVE_CTL_RATE
+	if (Control_Rate_Tick()) {
+#else
+	g_ctl_divider--;
+	if (g_ctl_divider == 0) {
+		g_ctl_divider = SW_CTL_FREQ_DIV_FACTOR;
+#endif
 		// Start conversion
+#if ENABLE_OVERCURRENT_TRIP
+		Overcurrent_Disarm(); // stop the compare conversions
+#endif
 		ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
 		
 	#if USE_ADC_INTERRUPT
 		// can return immediately
 	#else
 		// Call control function, which will wait for ADC coco
-		Control_HBLED();
+		CONTROL_HBLED();
 	#endif
 	}
+#if USE_DITHERED_PWM
+	else {
+		PWM_Dither_Step(); // no control update in this period
+	}
+#endif
+#endif // USE_ADC_OVERSAMPLING
 	DEBUG_STOP(DBG_TPM_ISR_POS);
 }
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
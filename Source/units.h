@@ -0,0 +1,93 @@
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+
+/* Fixed-point units of the current loop.
+ * The M0+ has no FPU, so every float or double operation is a call into the
+ * soft-float library (__aeabi_fmul, __aeabi_d2iz, ...) costing tens to
+ * hundreds of cycles. Conversions between these units are instead a multiply
+ * by an integer scale factor and a shift:
+ *   MA_T         LED current, mA
+ *   ADC_CODE_T   ADC0 result, 16 bits: current sense, scope samples
+ *   DAC_CODE_T   DAC0 data, 12 bits
+ *   SCOPE_T      scope trace height, SCOPE_ONE is the scope window
+ *   DUTY_T       PWM duty cycle, TPM0 counts
+ *   DUTY_GAIN_T  duty counts per mA, Q24.8 (PID and Proportional gains)
+ * The scale factors are integer constant expressions of the hardware values
+ * below. Floating-point constants are still fine where they are cast to an
+ * integer type, as in FL_TO_FX and FL_TO_DUTY_GAIN: the compiler folds them.
+ * "make" in Simulator fails if the control ISR or the 1 ms setpoint path does
+ * floating-point arithmetic at run time (float-check).
+ */
+
+typedef int MA_T;
+typedef uint16_t ADC_CODE_T;
+typedef uint16_t DAC_CODE_T;
+typedef int SCOPE_T;
+typedef int DUTY_T;
+typedef int32_t DUTY_GAIN_T;
+
+// Hardware
+#define R_SENSE_MO (2200)		// current sense resistor, milliohm
+#define V_REF_MV (3300)			// ADC and DAC reference
+#define R_SENSE (R_SENSE_MO/1000.0f)	// Ohm, for host-side tools
+#define V_REF (V_REF_MV/1000.0f)			// V, for host-side tools
+
+#define ADC_FULL_SCALE (0x10000)
+#define MA_SCALING_FACTOR (1000)
+#define DAC_RESOLUTION (4096)
+
+// Current at ADC full scale, V_REF/R_SENSE: 1500 mA
+#define ADC_FULL_SCALE_MA ((V_REF_MV*MA_SCALING_FACTOR)/R_SENSE_MO)
+
+// ADC codes per mA, Q15, rounded up: 43.69
+#define MA_TO_ADC_Q15 ((uint32_t) ((((uint64_t) ADC_FULL_SCALE << 15) + ADC_FULL_SCALE_MA - 1)/ADC_FULL_SCALE_MA))
+
+// DAC codes per mA, Q16, rounded: R_SENSE*DAC_RESOLUTION/V_REF = 2.731
+#define MA_TO_DAC_Q16 ((uint32_t) ((((uint64_t) R_SENSE_MO*DAC_RESOLUTION << 16) + V_REF_MV*MA_SCALING_FACTOR/2) \
+	/(V_REF_MV*MA_SCALING_FACTOR)))
+
+// Scope: the window spans SCOPE_ONE/SCOPE_PER_MA = 131 mA. SCOPE_PER_MA up
+// to 174 keeps ADC_Code_To_Scope_Y's product within 32 bits.
+#define SCOPE_ONE (0x4000)
+#define SCOPE_PER_MA (125)
+#define ADC_TO_SCOPE_Q14 ((uint32_t) (((uint64_t) SCOPE_PER_MA*ADC_FULL_SCALE_MA << 14)/ADC_FULL_SCALE))
+
+// Gains
+#define DUTY_GAIN_BITS (8)
+#define FL_TO_DUTY_GAIN(x) ((DUTY_GAIN_T) ((x)*(1 << DUTY_GAIN_BITS)))
+
+// Extra Credit: Explain why this can't use V_REF_MV*MA_SCALING_FACTOR)/(ADC_FULL_SCALE*R_SENSE)
+__STATIC_FORCEINLINE MA_T ADC_Code_To_mA(ADC_CODE_T code) {
+	return ((uint32_t) code*ADC_FULL_SCALE_MA) >> 16;
+}
+
+// Exact to one code: 6 of the currents up to full scale come out one high
+__STATIC_FORCEINLINE ADC_CODE_T MA_To_ADC_Code(MA_T i) {
+	if (i <= 0)
+		return 0;
+	if (i >= ADC_FULL_SCALE_MA)
+		return ADC_FULL_SCALE-1;
+	return ((uint32_t) i*MA_TO_ADC_Q15) >> 15;
+}
+
+// Exact (matches the rounded-down real quotient) up to 4000 mA
+__STATIC_FORCEINLINE DAC_CODE_T MA_To_DAC_Code(MA_T i) {
+	return ((uint32_t) i*MA_TO_DAC_Q16) >> 16;
+}
+
+// Scope row of an ADC code in a window height pixels tall, 0 at the top
+__STATIC_FORCEINLINE int ADC_Code_To_Scope_Y(ADC_CODE_T code, int height) {
+	SCOPE_T s = ((uint32_t) code*ADC_TO_SCOPE_Q14) >> 14;
+
+	return height - (height*s)/SCOPE_ONE;
+}
+
+// Duty cycle change for a Q24.8 sum of gain*mA terms, rounded down
+__STATIC_FORCEINLINE DUTY_T Duty_From_Gain_Sum(int32_t sum) {
+	return sum >> DUTY_GAIN_BITS;
+}
+
+#endif // UNITS_H
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "control.h"
+#include "ST7789.h"
+#include "waveform.h"
+
+static const WAVE_SEGMENT_T wave_rect[] = {{WAVE_ONE, WAVE_ONE, Wave_Step}};
+static const WAVE_SEGMENT_T wave_ramp[] = {{WAVE_ONE/2, WAVE_ONE, Wave_Linear}, {WAVE_ONE/2, 0, Wave_Linear}};
+// sin(pi*k/16), k = 0..16
+static const int16_t wave_sine_levels[] = {0, 195, 383, 556, 707, 831, 924, 981, 1000, 981, 924, 831, 707, 556, 383, 195, 0};
+// Custom pulse: full current, then a decay to about a quarter
+static const int16_t wave_user_levels[] = {1000, 1000, 800, 640, 512, 410, 328, 262};
+
+WAVE_SAMPLE_T g_wave_table[WAVE_MAX_SAMPLES];
+const WAVE_SAMPLE_T g_wave_off = {0, 0, 0};
+volatile int g_wave_shape = Wave_Rect, g_wave_edge_pct = WAVE_DEF_EDGE_PCT;
+volatile int g_wave_duration = 0, g_wave_samples = 1;
+volatile int g_wave_varying = 0, g_wave_version = 0;
+static int wave_shape, wave_edge_pct, wave_peak_mA; // compiled from
+
+// Level (per mille) at position p (per mille) of the pulse
+static int Wave_Level(const WAVE_DESC_T * d, int p) {
+	int i, s0 = 0, from = 0, len, k, r;
+
+	if (d->Segments == NULL) {
+		k = p*(d->Num_Levels - 1);
+		r = k % WAVE_ONE;
+		k /= WAVE_ONE;
+		if (k >= d->Num_Levels - 1)
+			return d->Levels[d->Num_Levels - 1];
+		return d->Levels[k] + ((d->Levels[k + 1] - d->Levels[k])*r)/WAVE_ONE;
+	}
+	for (i = 0; i < d->Num_Segments; i++) {
+		len = d->Segments[i].Length;
+		if ((p < s0 + len) || (i == d->Num_Segments - 1)) {
+			if ((d->Segments[i].Interp == Wave_Step) || (len == 0))
+				return d->Segments[i].Level;
+			if (p > s0 + len)
+				p = s0 + len;
+			return from + ((d->Segments[i].Level - from)*(p - s0))/len;
+		}
+		s0 += len;
+		from = d->Segments[i].Level;
+	}
+	return 0;
+}
+
+void Wave_Compile(void) {
+	WAVE_SEGMENT_T trap[3];
+	WAVE_DESC_T d = {NULL, 0, NULL, 0};
+	int j, n, p, mA, edge, prev = -1;
+
+	wave_shape = g_wave_shape;
+	wave_edge_pct = g_wave_edge_pct;
+	wave_peak_mA = g_peak_set_current_mA;
+	switch (wave_shape) {
+		case Wave_Ramp:
+			d.Segments = wave_ramp;
+			d.Num_Segments = sizeof(wave_ramp)/sizeof(wave_ramp[0]);
+			break;
+		case Wave_Trapezoid:
+			edge = (wave_edge_pct < 0)? 0 : (wave_edge_pct > WAVE_EDGE_MAX_PCT)? WAVE_EDGE_MAX_PCT : wave_edge_pct;
+			edge *= WAVE_ONE/100;
+			trap[0].Length = edge;
+			trap[0].Level = WAVE_ONE;
+			trap[0].Interp = Wave_Linear;
+			trap[1].Length = WAVE_ONE - 2*edge;
+			trap[1].Level = WAVE_ONE;
+			trap[1].Interp = Wave_Step;
+			trap[2].Length = edge;
+			trap[2].Level = 0;
+			trap[2].Interp = Wave_Linear;
+			d.Segments = trap;
+			d.Num_Segments = 3;
+			break;
+		case Wave_Sine:
+			d.Levels = wave_sine_levels;
+			d.Num_Levels = sizeof(wave_sine_levels)/sizeof(wave_sine_levels[0]);
+			break;
+		case Wave_User:
+			d.Levels = wave_user_levels;
+			d.Num_Levels = sizeof(wave_user_levels)/sizeof(wave_user_levels[0]);
+			break;
+		default:
+			d.Segments = wave_rect;
+			d.Num_Segments = sizeof(wave_rect)/sizeof(wave_rect[0]);
+			break;
+	}
+	g_wave_duration = g_flash_duration;
+	n = (g_wave_duration < 1)? 1 : (g_wave_duration > WAVE_MAX_SAMPLES)? WAVE_MAX_SAMPLES : g_wave_duration;
+	g_wave_varying = 0;
+	for (j = 0; j < n; j++) {
+		p = ((2*j + 1)*WAVE_ONE)/(2*n); // middle of ms j, or of slice j of a long pulse
+		mA = (wave_peak_mA*Wave_Level(&d, p) + WAVE_ONE/2)/WAVE_ONE;
+		g_wave_table[j].mA = mA;
+		g_wave_table[j].Code = MA_To_ADC_Code(mA);
+		g_wave_table[j].DAC = MA_To_DAC_Code(mA);
+		if ((prev >= 0) && (mA != prev))
+			g_wave_varying = 1;
+		prev = mA;
+	}
+	g_wave_samples = n;
+	g_wave_version++;
+}
+
+void Wave_Update(void) {
+	if ((g_wave_version == 0) || (wave_shape != g_wave_shape) || (wave_edge_pct != g_wave_edge_pct)
+		|| (g_wave_duration != g_flash_duration) || (wave_peak_mA != g_peak_set_current_mA))
+		Wave_Compile();
+}
+
+// UI: the slider position selects the shape
+void Wave_Shape_Handler(UI_FIELD_T * fld, int v) {
+	int s = ((v + UI_SLIDER_WIDTH/2)*WAVE_COUNT)/(UI_SLIDER_WIDTH + 1);
+
+	if ((s >= 0) && (s < WAVE_COUNT))
+		g_wave_shape = s;
+}
+
+// UI: the slider position sets the trapezoid's edge, 0 to WAVE_EDGE_MAX_PCT %
+void Wave_Edge_Handler(UI_FIELD_T * fld, int v) {
+	int e = ((v + UI_SLIDER_WIDTH/2)*WAVE_EDGE_MAX_PCT)/UI_SLIDER_WIDTH;
+
+	g_wave_edge_pct = (e < 0)? 0 : (e > WAVE_EDGE_MAX_PCT)? WAVE_EDGE_MAX_PCT : e;
+}
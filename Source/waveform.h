@@ -0,0 +1,95 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <MKL25Z4.h>
+#include <stdint.h>
+#include "control.h"
+#include "UI.h"
+
+/* Setpoint waveform engine.
+ * A flash pulse is described either as segments or as a level table:
+ *   - segments: each takes a fraction of the pulse and ends at a level,
+ *     reached at once (Wave_Step) or by a linear ramp (Wave_Linear)
+ *   - table: levels spaced evenly over the pulse, interpolated linearly
+ * Fractions and levels are per mille of the pulse and of
+ * g_peak_set_current_mA. Wave_Compile samples the selected description at
+ * the middle of each ms of the pulse into g_wave_table: the setpoint in mA,
+ * the scope code (g_set_current_code) and the DAC code. Update_Set_Current
+ * then reads one entry per tick. A pulse longer than WAVE_MAX_SAMPLES ms is
+ * sampled at the middle of WAVE_MAX_SAMPLES equal slices instead, and each
+ * tick interpolates between the two entries around it (Wave_Sample).
+ *
+ * Thread_Update_Setpoint calls Wave_Update at the start of each flash
+ * period; it recompiles if the shape, edge, duration or peak changed, so a
+ * pulse never sees a table change.
+ *   Wave_Rect       the rectangle (the default)
+ *   Wave_Ramp       linear up to the peak at mid-pulse and back down
+ *   Wave_Trapezoid  linear edges, each g_wave_edge_pct % of the pulse
+ *   Wave_Sine       half sine
+ *   Wave_User       wave_user_levels[] in waveform.c, for a custom pulse
+ * The UI "Wave" field's slider position selects the shape and "Edge" sets
+ * g_wave_edge_pct.
+ */
+
+#define WAVE_MAX_SAMPLES (64)	// ms
+#define WAVE_ONE (1000)				// per mille
+#define WAVE_EDGE_MAX_PCT (50)
+#define WAVE_DEF_EDGE_PCT (20)
+
+typedef enum {Wave_Rect, Wave_Ramp, Wave_Trapezoid, Wave_Sine, Wave_User, WAVE_COUNT} WAVE_SHAPE_E;
+typedef enum {Wave_Step, Wave_Linear} WAVE_INTERP_E;
+
+typedef struct {
+	uint16_t Length;	// per mille of the pulse
+	uint16_t Level;		// per mille of the peak, at the end of the segment
+	uint8_t Interp;		// WAVE_INTERP_E
+} WAVE_SEGMENT_T;
+
+typedef struct {
+	const WAVE_SEGMENT_T * Segments;	// NULL: use Levels
+	int Num_Segments;
+	const int16_t * Levels;						// per mille, evenly spaced from start to end of the pulse
+	int Num_Levels;
+} WAVE_DESC_T;
+
+typedef struct {
+	int16_t mA;
+	ADC_CODE_T Code;	// for the scope
+	DAC_CODE_T DAC;
+} WAVE_SAMPLE_T;
+
+extern WAVE_SAMPLE_T g_wave_table[WAVE_MAX_SAMPLES];
+extern const WAVE_SAMPLE_T g_wave_off;
+extern volatile int g_wave_shape, g_wave_edge_pct;	// UI
+extern volatile int g_wave_duration;	// ms of pulse, as compiled
+extern volatile int g_wave_samples;		// entries in g_wave_table
+extern volatile int g_wave_varying;		// setpoint changes within the pulse
+extern volatile int g_wave_version;		// counts compiles
+
+void Wave_Compile(void);
+void Wave_Update(void);	// compile if the description or flash changed
+void Wave_Shape_Handler(UI_FIELD_T * fld, int v);
+void Wave_Edge_Handler(UI_FIELD_T * fld, int v);
+
+// Sample for ms j of the pulse
+__STATIC_FORCEINLINE WAVE_SAMPLE_T Wave_Sample(int j) {
+	WAVE_SAMPLE_T s;
+	int n = g_wave_samples, d = g_wave_duration, x, k, r;
+
+	if (d <= n)
+		return g_wave_table[(j < n)? j : n - 1];
+	// Middle of ms j in entries from the middle of entry 0, in 1/(2d) steps
+	x = (2*j + 1)*n - d;
+	if (x <= 0)
+		return g_wave_table[0];
+	k = x/(2*d);
+	r = x - k*2*d;
+	if (k >= n - 1)
+		return g_wave_table[n - 1];
+	s.mA = g_wave_table[k].mA + ((g_wave_table[k + 1].mA - g_wave_table[k].mA)*r)/(2*d);
+	s.Code = MA_To_ADC_Code(s.mA);
+	s.DAC = MA_To_DAC_Code(s.mA);
+	return s;
+}
+
+#endif // WAVEFORM_H